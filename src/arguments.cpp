@@ -3,6 +3,8 @@
 #include <cstring>
 #include <stdexcept>
 #include <limits>
+#include <thread>
+#include <algorithm>
 
 namespace edsac {
 
@@ -42,15 +44,55 @@ void arguments_t::init(int argn, const char ** args) {
             // full name conf
             const char * arg = curr + 2;
             if (is_arg_name(arg, "io")) {
-                io = std::atoi(get_arg_value(it, end));
-                if (io != 1 && io != 2)
-                    throw std::invalid_argument("unsupported specification: Initial Orders " + std::to_string(io));
+                std::string value = get_arg_value(it, end);
+                targets.clear();
+                for (size_t at = 0; at <= value.size(); ) {
+                    size_t comma = std::min(value.find(',', at), value.size());
+                    io = std::atoi(value.substr(at, comma - at).c_str());
+                    if (io != 1 && io != 2)
+                        throw std::invalid_argument("unsupported specification: Initial Orders " + std::to_string(io));
+                    if (std::find(targets.begin(), targets.end(), io) == targets.end())
+                        targets.push_back(io);
+                    at = comma + 1;
+                }
+                // a program without ~io is parsed for Initial Orders 2, they have every order of Initial Orders 1
+                io = *std::max_element(targets.begin(), targets.end());
+                if (targets.size() == 1)
+                    targets.clear();
             } else if (is_arg_name(arg, "input"))
                 input = get_arg_value(it, end);
             else if (is_arg_name(arg, "output"))
                 output = get_arg_value(it, end);
-            else if (is_arg_name(arg, "debug"))
+            else if (is_arg_name(arg, "cache"))
+                cache = get_arg_value(it, end);
+            else if (is_arg_name(arg, "jobs")) {
+                jobs = assert_arg_range<unsigned short>(std::atoi(get_arg_value(it, end)), "jobs");
+                if (jobs == 0)
+                    throw std::invalid_argument("'jobs' value must be at least 1");
+            } else if (is_arg_name(arg, "format")) {
+                std::string value = get_arg_value(it, end);
+                if (value == "text")
+                    format = format_t::text;
+                else if (value == "image")
+                    format = format_t::image;
+                else
+                    throw std::invalid_argument("unsupported output format '" + value + "'");
+            } else if (is_arg_name(arg, "debug"))
                 debug = true;
+            else if (is_arg_name(arg, "reserve-arrays"))
+                reserve_arrays = true;
+            else if (is_arg_name(arg, "optimize"))
+                optimize = true;
+            else if (is_arg_name(arg, "bounds-check"))
+                bounds_check = true;
+            else if (is_arg_name(arg, "object"))
+                object = true;
+            else if (is_arg_name(arg, "link"))
+                link = true;
+            else if (is_arg_name(arg, "watch"))
+                watch = true;
+            else if (is_arg_name(arg, "lsp"))
+                lsp = true;
             else if (is_arg_name(arg, "help"))
                 help = true;
             else
@@ -59,14 +101,19 @@ void arguments_t::init(int argn, const char ** args) {
             // literal options
             const char * arg = curr + 1;
             while(char c = *(arg++)) {
-                if (c == '1')
+                if (c == '1') {
                     io = 1;
-                else if (c == '2')
+                    targets.clear();
+                } else if (c == '2') {
                     io = 2;
+                    targets.clear();
+                }
                 else if (c == 'd')
                     debug = true;
                 else if (c == 'h')
                     help = true;
+                else if (c == 'O')
+                    optimize = true;
                 else
                     throw std::invalid_argument(std::string("unrecognized option '") + c + "'");
             }
@@ -74,6 +121,19 @@ void arguments_t::init(int argn, const char ** args) {
             other.emplace_back(curr);
         }
     }
+    if (!targets.empty() && (object || watch || lsp))
+        throw std::invalid_argument("several Initial Orders can't be used with 'object', 'watch' or 'lsp'");
+    if (bounds_check && (watch || lsp))
+        throw std::invalid_argument("'bounds-check' can't be used with 'watch' or 'lsp'");
+    if (object && link)
+        throw std::invalid_argument("'object' and 'link' can't be used together");
+    if (jobs == 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+}
+
+std::ios::openmode arguments_t::output_mode() const {
+    bool binary = format == format_t::image || object;
+    return binary ? std::ios::out | std::ios::binary : std::ios::out;
 }
 
 }
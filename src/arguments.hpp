@@ -3,17 +3,47 @@
 
 #include <vector>
 #include <string>
+#include <ios>
 
 namespace edsac {
 
+// must be changed whenever generated tapes change, it is a part of the cache key
+constexpr char compiler_version[] = "1.4";
+
+enum class format_t {
+    // tape for Initial Orders
+    text,
+    // assembled store, see store_image
+    image
+};
+
 struct arguments_t {
     int io = 2;
+    // Initial Orders of --io=1,2, the program is written for each of them, empty for one
+    std::vector<int> targets;
+    format_t format = format_t::text;
     std::string input;
     std::string output;
+    std::string cache;
+    // threads for the compilation of one program
+    unsigned jobs = 0;
     bool help = false;
     bool debug = false;
+    // do not load zeros of arrays in Initial Orders 2
+    bool reserve_arrays = false;
+    // inline small subroutines
+    bool optimize = false;
+    // check indexes of a[i] at run time
+    bool bounds_check = false;
+    // write an object file instead of a program, link object files given as other arguments
+    bool object = false;
+    bool link = false;
+    bool watch = false;
+    bool lsp = false;
     std::vector<std::string> other;
     void init(int argn, const char ** args);
+    // images and objects are binary, tapes are text
+    std::ios::openmode output_mode() const;
 } extern arguments;
 
 } // edsac
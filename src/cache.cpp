@@ -0,0 +1,90 @@
+#include "cache.hpp"
+
+#include <fstream>
+#include <filesystem>
+#include <random>
+#include <system_error>
+#include <stdexcept>
+
+namespace edsac {
+
+namespace fs = std::filesystem;
+
+// FNV-1a, good enough to address the tapes and much faster than the parser
+struct fnv1a {
+    std::uint64_t value = 0xcbf29ce484222325ull;
+    void update(const char * data, std::size_t n) {
+        for (std::size_t i = 0; i < n; i++) {
+            value ^= static_cast<unsigned char>(data[i]);
+            value *= 0x100000001b3ull;
+        }
+    }
+    void update(const std::string & str) {
+        update(str.data(), str.size());
+    }
+};
+
+compile_cache::compile_cache(const std::string & dir) : directory(dir) {
+    std::error_code ec;
+    fs::create_directories(directory, ec);
+    if (ec)
+        throw std::runtime_error("can't create cache directory '" + directory + "': " + ec.message());
+}
+
+// options and the source, as they are written before the tape in the entry
+std::string compile_cache::key(const std::string & source, const arguments_t & args) {
+    std::string key = compiler_version;
+    for (int option : { args.io, static_cast<int>(args.format), int(args.debug), int(args.reserve_arrays),
+            int(args.optimize), int(args.bounds_check), int(args.object) })
+        key += ' ' + std::to_string(option);
+    key += '\n';
+    key += source;
+    return key;
+}
+
+std::string compile_cache::path_of(const std::string & key) const {
+    fnv1a hash;
+    hash.update(key);
+    static const char digits[] = "0123456789abcdef";
+    std::string name(16, '0');
+    std::uint64_t value = hash.value;
+    for (int i = 15; i >= 0; i--, value >>= 4)
+        name[i] = digits[value & 0xf];
+    return (fs::path(directory) / (name + ".edsac")).string();
+}
+
+bool compile_cache::load(const std::string & key, std::ostream & out) const {
+    std::ifstream file(path_of(key), std::ios::binary);
+    if (!file)
+        return false;
+    // an entry of another key with the same hash is a miss
+    std::size_t size = 0;
+    if (!(file >> size) || file.get() != '\n' || size != key.size())
+        return false;
+    std::string stored(size, '\0');
+    if (!file.read(stored.data(), size) || stored != key)
+        return false;
+    if (file.peek() != std::ifstream::traits_type::eof())
+        out << file.rdbuf();
+    return true;
+}
+
+void compile_cache::store(const std::string & key, const std::string & tape) const {
+    std::string path = path_of(key);
+    std::random_device random;
+    std::string tmp = path + ".tmp" + std::to_string(random()) + std::to_string(random());
+    std::ofstream file(tmp, std::ios::binary);
+    file << key.size() << '\n';
+    file.write(key.data(), key.size());
+    file.write(tape.data(), tape.size());
+    file.close();
+    std::error_code ec;
+    // a partial entry is not renamed and not left behind
+    if (file.fail())
+        fs::remove(tmp, ec);
+    else if (fs::rename(tmp, path, ec), ec)
+        // someone else won the race or the file system can't replace files
+        fs::remove(tmp, ec);
+}
+
+} // edsac
@@ -0,0 +1,36 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <string>
+#include <ostream>
+#include <cstdint>
+
+#include "arguments.hpp"
+
+namespace edsac {
+
+// Content addressed store of compiled tapes. Every entry is a single file named
+// after the hash of the key, the source and all options that affect the output.
+// The entry keeps the key itself, so two keys with the same hash never share a tape.
+class compile_cache {
+private:
+    std::string directory;
+
+    std::string path_of(const std::string & key) const;
+
+public:
+    explicit compile_cache(const std::string & dir);
+
+    static std::string key(const std::string & source, const arguments_t & args);
+
+    // streams the stored tape to out, returns false on cache miss
+    bool load(const std::string & key, std::ostream & out) const;
+    // writes into a temporary file first and renames it, so concurrent
+    // compilers sharing the directory never see a partial entry
+    void store(const std::string & key, const std::string & tape) const;
+};
+
+} // edsac
+
+
+#endif // CACHE_H
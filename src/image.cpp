@@ -0,0 +1,72 @@
+#include "image.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "parser.hpp"
+
+namespace edsac {
+
+void store_image::put(int address, std::uint32_t word) {
+    if (address < 0 || address > 0xffff)
+        throw std::runtime_error("address " + std::to_string(address) + " is out of the store");
+    if (segments.empty() || segments.back().address + int(segments.back().words.size()) != address)
+        segments.push_back({ address, {} });
+    segments.back().words.push_back(word);
+}
+
+int store_image::put_text(int address, std::string_view text, int io) {
+    for (std::size_t i = 0; i < text.size(); ) {
+        char letter = text[i++];
+        if (letter_codes[static_cast<unsigned char>(letter)] < 0)
+            throw std::runtime_error(std::string("unexpected order code '") + letter + "' in a constant");
+        int number = 0;
+        for (; i < text.size() && text[i] >= '0' && text[i] <= '9'; i++)
+            number = number * 10 + (text[i] - '0');
+        bool is_long = i < text.size() && text[i] == '#';
+        if (is_long)
+            i++;
+        if (i == text.size())
+            throw std::runtime_error("constant '" + std::string(text) + "' has no suffix");
+        char suffix = text[i++];
+        is_long = is_long || suffix == (io == 2 ? 'D' : 'L');
+        put(address++, make_word(letter, number, is_long));
+    }
+    return address;
+}
+
+template <typename T>
+void write_le(std::ostream & out, T value, int bytes = sizeof(T)) {
+    for (int i = 0; i < bytes; i++)
+        out.put(static_cast<char>(static_cast<std::uint64_t>(value) >> (i * 8)));
+}
+
+void store_image::write(std::ostream & out, const vars_t & vars, int io) const {
+    out.write("EDSI", 4);
+    write_le<std::uint8_t>(out, version);
+    write_le<std::uint8_t>(out, io);
+    write_le<std::uint16_t>(out, entry < 0 ? base_address(io) : entry);
+    write_le<std::uint32_t>(out, segments.size());
+    for (auto & s : segments) {
+        write_le<std::uint16_t>(out, s.address);
+        write_le<std::uint16_t>(out, s.words.size());
+        for (std::uint32_t word : s.words)
+            write_le(out, word, 3);
+    }
+    // sorted, so the same program always gives the same image
+    std::vector<std::pair<int, std::string_view>> symbols;
+    symbols.reserve(vars.size());
+    for (auto & var : vars)
+        symbols.emplace_back(var.second, var.first);
+    std::sort(symbols.begin(), symbols.end());
+    write_le<std::uint32_t>(out, symbols.size());
+    for (auto & symbol : symbols) {
+        write_le<std::uint16_t>(out, symbol.second.size());
+        out.write(symbol.second.data(), symbol.second.size());
+        write_le<std::int32_t>(out, symbol.first);
+    }
+}
+
+} // edsac
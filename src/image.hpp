@@ -0,0 +1,67 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <ostream>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <cstdint>
+
+#include "predicates.hpp"
+
+namespace edsac {
+
+// order code of every letter of char_table, -1 for other characters
+constexpr std::array<signed char, 256> make_letter_codes() {
+    std::array<signed char, 256> codes {};
+    for (auto & code : codes)
+        code = -1;
+    for (std::size_t i = 0; i < char_table.size(); i++)
+        codes[static_cast<unsigned char>(char_table[i])] = static_cast<signed char>(i);
+    return codes;
+}
+
+constexpr std::array<signed char, 256> letter_codes = make_letter_codes();
+
+static_assert(letter_codes['P'] == 0 && letter_codes['V'] == 31 && letter_codes['F'] == 17, "broken char_table");
+
+// 17 bit word of the order with the code letter, address and long bit
+constexpr std::uint32_t make_word(char letter, int address, bool is_long) {
+    return ((static_cast<std::uint32_t>(letter_codes[static_cast<unsigned char>(letter)]) << 12) +
+        (static_cast<std::uint32_t>(address) << 1) + is_long) & 0x1ffff;
+}
+
+// Store of EDSAC as it is after Initial Orders loaded the program, words out of the segments are zero.
+// The binary form is little endian:
+//   "EDSI", u8 format version, u8 Initial Orders, u16 entry address,
+//   u32 number of segments, for every segment u16 address, u16 number of words and 3 bytes for every word,
+//   u32 number of symbols, for every symbol u16 length of the name, the name and i32 value.
+class store_image {
+public:
+    static constexpr std::uint8_t version = 1;
+
+    struct segment {
+        int address;
+        std::vector<std::uint32_t> words;
+    };
+
+private:
+    std::vector<segment> segments;
+    int entry = -1;
+
+public:
+    // the word goes to the last segment if it continues it
+    void put(int address, std::uint32_t word);
+    // puts words of a tape like "P22DP0F" for the Initial Orders from the address, returns the address after them
+    int put_text(int address, std::string_view text, int io);
+    void set_entry(int address) { entry = address; }
+
+    const std::vector<segment> & parts() const { return segments; }
+    // Initial Orders jump to the first word of the program if there is no E m K
+    void write(std::ostream & out, const vars_t & vars, int io) const;
+};
+
+} // edsac
+
+
+#endif // IMAGE_H
@@ -0,0 +1,285 @@
+#include "incremental.hpp"
+
+#include <unordered_set>
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <exception>
+
+#include "arguments.hpp"
+#include "module.hpp"
+#include "macro.hpp"
+
+namespace edsac {
+
+int count_line_breaks(const char * str, int size) {
+    int lines = 0;
+    for (int i = 0; i < size; i++) {
+        if (str[i] == '\n' || (str[i] == '\r' && (i + 1 == size || str[i + 1] != '\n')))
+            lines++;
+    }
+    return lines;
+}
+
+void incremental_compiler::write_tape(std::ostream & out) const {
+    if (arguments.format == format_t::image) {
+        std::vector<predicate_t *> all;
+        for (auto & r : regions)
+            for (auto & p : r->predicates)
+                all.push_back(p.get());
+        return write_image(out, all, vars, linked_io);
+    }
+    std::string tape;
+    for (auto & r : regions)
+        tape += r->tape;
+    write_header(out, linked_io);
+    out << tape;
+    write_vars(out, vars);
+}
+
+int incremental_compiler::update(const std::string & input, std::ostream & out, std::ostream & err) {
+    edsac::err = &err;
+    // regions are parts of the text with expanded macros, a changed macro changes every line it is used in
+    macro_table macros;
+    int at = 0;
+    std::string text;
+    source_map positions;
+    try {
+        text = preprocess(input, at, macros, directory, &positions);
+    } catch (const std::exception & e) {
+        auto pair = count_lines(input.c_str(), at);
+        err << "compilation error:" << pair.first << ":" << pair.second << ": " << e.what() << std::endl;
+        return 1;
+    }
+    // messages give positions in the input
+    original = input;
+    map = std::move(positions);
+    const char * str = text.c_str();
+    int size = text.size();
+    int old_size = source.size();
+    size_t old_n = regions.size();
+
+    // bytes that did not change at both ends of the text
+    int same_begin = std::mismatch(text.begin(), text.begin() + std::min(size, old_size), source.begin()).first - text.begin();
+    int same_end = std::mismatch(text.rbegin(), text.rbegin() + (std::min(size, old_size) - same_begin), source.rbegin()).first - text.rbegin();
+    // a region that includes a changed file is parsed again with everything after it
+    for (auto & r : regions) {
+        auto & included = r->exit.included;
+        if (std::any_of(included.begin() + r->entry.included.size(), included.end(), [](const module_t * m) { return is_changed(*m); })) {
+            same_begin = std::min(same_begin, r->start);
+            same_end = 0;
+            break;
+        }
+    }
+    if (same_begin == size && size == old_size && linked_io) {
+        for (auto & r : regions)
+            write_warnings(err, original.c_str(), map, r->start, r->warnings);
+        write_tape(out);
+        return 0;
+    }
+    int delta = size - old_size;
+
+    // the region with the first changed byte, the change can continue the line before it
+    size_t first = 0;
+    if (same_begin > 0 && old_n > 0) {
+        first = std::upper_bound(regions.begin(), regions.end(), same_begin - 1,
+            [](int at, const std::unique_ptr<region> & r) { return at < r->start; }) - regions.begin() - 1;
+    }
+    int from = first < old_n ? regions[first]->start : 0;
+    int line = first < old_n ? regions[first]->line : 0;
+
+    // Parse regions of the new text until one of them starts where an old one starts in the unchanged end.
+    // If a region fails or leaves a block open, the splitter missed a block, so the whole text is parsed as one region.
+    std::vector<std::unique_ptr<region>> middle;
+    size_t resume = old_n;
+    for (bool whole = false; ; whole = true) {
+        if (whole) {
+            first = 0;
+            from = 0;
+            line = 0;
+            middle.clear();
+        }
+        parse_state state = first ? regions[first - 1]->exit : parse_state{ io };
+        resume = old_n;
+        size_t scan = first;
+        bool split = false;
+        line_splitter splitter(str, size, from);
+        for (int start = from; start < size || middle.empty(); ) {
+            if (!whole && start >= size - same_end) {
+                while (scan < old_n && regions[scan]->start + delta < start)
+                    scan++;
+                if (scan < old_n && regions[scan]->start + delta == start && regions[scan]->entry == state) {
+                    resume = scan;
+                    break;
+                }
+            }
+            int end = whole ? size : splitter.next();
+            auto r = std::make_unique<region>();
+            r->text = text.substr(start, end - start);
+            r->origin = next_origin + start;
+            r->start = start;
+            r->line = line;
+            r->entry = state;
+            parse_context ctx(r->text.c_str(), r->origin, r->line, state, &r->memory);
+            ctx.directory = directory;
+            ctx.source = original.c_str();
+            ctx.map = &map;
+            ctx.start = start;
+            int i = 0;
+            try {
+                parse_source(i, r->text.size(), ctx);
+            } catch (const std::exception & e) {
+                if (!whole) {
+                    split = true;
+                    break;
+                }
+                for (auto & m : middle)
+                    write_warnings(err, original.c_str(), map, m->start, m->warnings);
+                ctx.write_warnings(err);
+                auto pair = ctx.position(i);
+                err << "compilation error:" << pair.first << ":" << pair.second << ": " << e.what() << std::endl;
+                // the previous version stays to be compared with the next one
+                return 1;
+            }
+            if (!whole && !ctx.stack.empty()) {
+                split = true;
+                break;
+            }
+            state = r->exit = ctx.state;
+            r->predicates = std::move(ctx.predicates);
+            r->warnings = std::move(ctx.warnings);
+            r->declarations = std::move(ctx.declarations);
+            r->position_dependent = arguments.debug;
+            for (auto & p : r->predicates) {
+                if (const std::string_view * name = p->definition())
+                    r->definitions.push_back(name);
+                names_t names = p->references();
+                for (const std::string_view * name = names.first; name != names.second; name++)
+                    r->references.push_back(name);
+                r->position_dependent = r->position_dependent || is_position_dependent(*p);
+            }
+            line += count_line_breaks(r->text.c_str(), r->text.size());
+            middle.push_back(std::move(r));
+            start = end;
+        }
+        if (!split)
+            break;
+    }
+    next_origin += size + 1;
+    source = text;
+
+    // the new version of the program
+    int line_delta = resume < old_n ? line - regions[resume]->line : 0;
+    std::vector<std::unique_ptr<region>> removed;
+    for (size_t k = first; k < resume; k++)
+        removed.push_back(std::move(regions[k]));
+    for (size_t k = resume; k < old_n; k++) {
+        regions[k]->start += delta;
+        regions[k]->line += line_delta;
+    }
+    regions.erase(regions.begin() + first, regions.begin() + resume);
+    regions.insert(regions.begin() + first, std::make_move_iterator(middle.begin()), std::make_move_iterator(middle.end()));
+    size_t n = regions.size();
+    size_t changed_end = first + middle.size();
+
+    for (auto & r : regions)
+        write_warnings(err, original.c_str(), map, r->start, r->warnings);
+
+    int program_io = arguments.io = target_io = regions.back()->exit.io;
+    bool full = linked_io != program_io;
+    linked_io = 0;
+    try {
+        // forget addresses from the first changed region, but remember them to find what moved
+        vars_t previous;
+        auto forget = [&](const region & r) {
+            for (const std::string_view * name : r.definitions) {
+                auto iter = vars.find(*name);
+                if (iter != vars.end()) {
+                    previous.insert(*iter);
+                    vars.erase(iter);
+                }
+            }
+        };
+        int last_instruction = -1;
+        if (full) {
+            first = 0;
+            vars.clear();
+        } else {
+            last_instruction = vars["LAST_INSTRUCTION"];
+            for (auto & r : removed)
+                forget(*r);
+            for (size_t k = first; k < n; k++)
+                forget(*regions[k]);
+        }
+
+        // assign addresses
+        int address = first ? regions[first - 1]->end : base_address(program_io);
+        for (size_t k = first; k < n; k++) {
+            region & r = *regions[k];
+            r.begin = address;
+            for (auto & p : r.predicates)
+                address = p->initialize(address, vars);
+            r.end = address;
+        }
+        define_constants(vars, address, program_io);
+
+        std::unordered_set<std::string_view> changed;
+        if (last_instruction != address)
+            changed.insert("LAST_INSTRUCTION");
+        for (size_t k = first; k < n; k++) {
+            for (const std::string_view * name : regions[k]->definitions) {
+                auto iter = previous.find(*name);
+                if (iter == previous.end() || iter->second != vars[*name])
+                    changed.insert(*name);
+                if (iter != previous.end())
+                    previous.erase(iter);
+            }
+        }
+        for (auto & var : previous)
+            changed.insert(var.first);
+
+        // link and write only the regions that can produce a different tape
+        std::ostringstream tape;
+        int offset = 0;
+        for (size_t k = 0; k < n; k++) {
+            region & r = *regions[k];
+            bool relink = full || r.linked_at < 0 || (k >= first && k < changed_end) || r.entry_offset != offset ||
+                (r.position_dependent && r.linked_at != r.begin);
+            if (!relink && !changed.empty()) {
+                for (const std::string_view * name : r.references) {
+                    if (changed.count(*name)) {
+                        relink = true;
+                        break;
+                    }
+                }
+            }
+            if (!relink) {
+                offset = r.exit_offset;
+                continue;
+            }
+            r.linked_at = -1;
+            r.entry_offset = offset;
+            std::exception_ptr error;
+            auto stop = relocate(r.predicates.begin(), r.predicates.end(), vars, offset, error);
+            for (auto iter = r.predicates.begin(); iter != stop; ++iter)
+                (*iter)->resolve(vars);
+            if (error)
+                std::rethrow_exception(error);
+            r.exit_offset = offset;
+            tape.str(std::string());
+            for (auto & p : r.predicates)
+                p->write_to(tape);
+            r.tape = tape.str();
+            r.linked_at = r.begin;
+        }
+    } catch (const std::exception & e) {
+        err << "link time error: " << e.what() << std::endl;
+        return 2;
+    }
+    linked_io = program_io;
+    write_tape(out);
+    return 0;
+}
+
+} // edsac
@@ -0,0 +1,83 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <ostream>
+#include <string_view>
+#include <memory_resource>
+
+#include "parser.hpp"
+#include "macro.hpp"
+
+namespace edsac {
+
+// Keeps a parsed and linked program between compilations of its versions.
+// The source is split by line_splitter into regions, only the regions that
+// differ from the previous version are parsed again. Addresses are assigned
+// again from the first changed region and only the regions that reference
+// moved names or depend on their own addresses are linked again.
+class incremental_compiler {
+public:
+    struct region {
+        std::string text;
+        // offset for generated names, offset and first line of the region in the source
+        long long origin;
+        int start;
+        int line;
+        parse_state entry;
+        parse_state exit;
+        // predicates and names of the region, vars refer to them while the region is a part of the program
+        std::pmr::monotonic_buffer_resource memory;
+        predicates_t predicates;
+        std::vector<std::pair<int, std::string>> warnings;
+        std::vector<std::pair<std::string_view, int>> declarations;
+        std::vector<const std::string_view *> definitions;
+        std::vector<const std::string_view *> references;
+        // the tape can change when the region is moved
+        bool position_dependent = false;
+        // addresses of the region in store
+        int begin = -1;
+        int end = -1;
+        // begin address the region was linked with, -1 if it was not linked yet
+        int linked_at = -1;
+        int entry_offset = 0;
+        int exit_offset = 0;
+        std::string tape;
+    };
+
+private:
+    // the last text with expanded macros, the input it was made of and the offsets of one in the other
+    std::string source;
+    std::string original;
+    source_map map;
+    std::vector<std::unique_ptr<region>> regions;
+    vars_t vars;
+    int io;
+    // directory of ~include files, the directory of the input file if it is empty
+    std::string directory;
+    // Initial Orders of the linked program, 0 if vars are not valid
+    int linked_io = 0;
+    // origins of regions are never used again, a session of any length does not run out of them
+    long long next_origin = 0;
+
+    void write_tape(std::ostream & out) const;
+
+public:
+    explicit incremental_compiler(int default_io, std::string dir = "") : io(default_io), directory(std::move(dir)) {}
+
+    // compiles the new version of the program, returns the same codes as parser::parse
+    int update(const std::string & text, std::ostream & out, std::ostream & err);
+
+    const std::vector<std::unique_ptr<region>> & parts() const { return regions; }
+    const vars_t & symbols() const { return vars; }
+    // offset in the input of an offset in the text of the regions
+    int input_offset(int offset) const { return map.source_offset(offset); }
+};
+
+} // edsac
+
+
+#endif // INCREMENTAL_H
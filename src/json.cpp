@@ -0,0 +1,267 @@
+#include "json.hpp"
+
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+
+namespace edsac {
+
+json json::make_array(std::vector<json> && elements) {
+    json result;
+    result.type = type_t::array;
+    result.array = std::move(elements);
+    return result;
+}
+
+json json::make_object(std::initializer_list<std::pair<std::string, json>> members) {
+    json result;
+    result.type = type_t::object;
+    result.object = members;
+    return result;
+}
+
+const json & json::operator[](const std::string & key) const {
+    static const json null;
+    for (auto & member : object)
+        if (member.first == key)
+            return member.second;
+    return null;
+}
+
+void json::set(const std::string & key, const json & value) {
+    type = type_t::object;
+    for (auto & member : object) {
+        if (member.first == key) {
+            member.second = value;
+            return;
+        }
+    }
+    object.emplace_back(key, value);
+}
+
+struct json_reader {
+    const std::string & text;
+    size_t i = 0;
+
+    json_reader(const std::string & t) : text(t) {}
+
+    void skip_space() {
+        while (i < text.size() && (text[i] == ' ' || text[i] == '\t' || text[i] == '\n' || text[i] == '\r'))
+            i++;
+    }
+
+    char next() {
+        skip_space();
+        if (i >= text.size())
+            throw std::runtime_error("unexpected end of JSON");
+        return text[i];
+    }
+
+    void expect(const char * word) {
+        for (; *word; word++, i++)
+            if (i >= text.size() || text[i] != *word)
+                throw std::runtime_error("unexpected character in JSON");
+    }
+
+    static void append_utf8(std::string & out, unsigned code) {
+        if (code < 0x80) {
+            out += char(code);
+        } else if (code < 0x800) {
+            out += char(0xc0 | (code >> 6));
+            out += char(0x80 | (code & 0x3f));
+        } else if (code < 0x10000) {
+            out += char(0xe0 | (code >> 12));
+            out += char(0x80 | ((code >> 6) & 0x3f));
+            out += char(0x80 | (code & 0x3f));
+        } else {
+            out += char(0xf0 | (code >> 18));
+            out += char(0x80 | ((code >> 12) & 0x3f));
+            out += char(0x80 | ((code >> 6) & 0x3f));
+            out += char(0x80 | (code & 0x3f));
+        }
+    }
+
+    unsigned read_hex4() {
+        if (i + 4 > text.size())
+            throw std::runtime_error("bad unicode escape in JSON string");
+        unsigned code = std::strtoul(text.substr(i, 4).c_str(), nullptr, 16);
+        i += 4;
+        return code;
+    }
+
+    std::string read_string() {
+        std::string result;
+        i++;
+        while (true) {
+            if (i >= text.size())
+                throw std::runtime_error("JSON string not closed");
+            char c = text[i++];
+            if (c == '"')
+                return result;
+            if (c != '\\') {
+                result += c;
+                continue;
+            }
+            if (i >= text.size())
+                throw std::runtime_error("JSON string not closed");
+            switch (c = text[i++]) {
+                case 'b': result += '\b'; break;
+                case 'f': result += '\f'; break;
+                case 'n': result += '\n'; break;
+                case 'r': result += '\r'; break;
+                case 't': result += '\t'; break;
+                case 'u': {
+                    unsigned code = read_hex4();
+                    if (code >= 0xd800 && code < 0xdc00 && text.compare(i, 2, "\\u") == 0) {
+                        i += 2;
+                        unsigned low = read_hex4();
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                    }
+                    append_utf8(result, code);
+                    break;
+                }
+                default: result += c; break;
+            }
+        }
+    }
+
+    json read() {
+        switch (next()) {
+            case '{': {
+                json result = json::make_object({});
+                i++;
+                if (next() == '}') {
+                    i++;
+                    return result;
+                }
+                while (true) {
+                    if (next() != '"')
+                        throw std::runtime_error("member name expected in JSON object");
+                    std::string key = read_string();
+                    if (next() != ':')
+                        throw std::runtime_error("':' expected in JSON object");
+                    i++;
+                    result.object.emplace_back(std::move(key), read());
+                    char c = next();
+                    i++;
+                    if (c == '}')
+                        return result;
+                    if (c != ',')
+                        throw std::runtime_error("',' expected in JSON object");
+                }
+            }
+            case '[': {
+                json result = json::make_array({});
+                i++;
+                if (next() == ']') {
+                    i++;
+                    return result;
+                }
+                while (true) {
+                    result.array.push_back(read());
+                    char c = next();
+                    i++;
+                    if (c == ']')
+                        return result;
+                    if (c != ',')
+                        throw std::runtime_error("',' expected in JSON array");
+                }
+            }
+            case '"':
+                return json(read_string());
+            case 't':
+                expect("true");
+                return json(true);
+            case 'f':
+                expect("false");
+                return json(false);
+            case 'n':
+                expect("null");
+                return json();
+            default: {
+                const char * begin = text.c_str() + i;
+                char * end;
+                double value = std::strtod(begin, &end);
+                if (end == begin)
+                    throw std::runtime_error(std::string("unexpected character in JSON '") + *begin + "'");
+                i += end - begin;
+                return json(value);
+            }
+        }
+    }
+};
+
+json json::parse(const std::string & text) {
+    json_reader reader(text);
+    return reader.read();
+}
+
+std::string json::dump() const {
+    std::string out;
+    dump_to(out);
+    return out;
+}
+
+void dump_string(std::string & out, const std::string & str) {
+    out += '"';
+    for (char c : str) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buffer[8];
+                    std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    out += buffer;
+                } else
+                    out += c;
+        }
+    }
+    out += '"';
+}
+
+void json::dump_to(std::string & out) const {
+    switch (type) {
+        case type_t::null:
+            out += "null";
+            break;
+        case type_t::boolean:
+            out += boolean ? "true" : "false";
+            break;
+        case type_t::number:
+            if (number == std::floor(number) && std::fabs(number) < 1e15)
+                out += std::to_string(static_cast<long long>(number));
+            else
+                out += std::to_string(number);
+            break;
+        case type_t::string:
+            dump_string(out, string);
+            break;
+        case type_t::array:
+            out += '[';
+            for (size_t k = 0; k < array.size(); k++) {
+                if (k)
+                    out += ',';
+                array[k].dump_to(out);
+            }
+            out += ']';
+            break;
+        case type_t::object:
+            out += '{';
+            for (size_t k = 0; k < object.size(); k++) {
+                if (k)
+                    out += ',';
+                dump_string(out, object[k].first);
+                out += ':';
+                object[k].second.dump_to(out);
+            }
+            out += '}';
+            break;
+    }
+}
+
+} // edsac
@@ -0,0 +1,50 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <initializer_list>
+
+namespace edsac {
+
+// Just enough of JSON for the language server protocol
+struct json {
+    enum class type_t {
+        null, boolean, number, string, array, object
+    };
+    typedef std::vector<std::pair<std::string, json>> members_t;
+
+    type_t type = type_t::null;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<json> array;
+    members_t object;
+
+    json() {}
+    json(std::nullptr_t) {}
+    json(bool b) : type(type_t::boolean), boolean(b) {}
+    json(int n) : type(type_t::number), number(n) {}
+    json(double n) : type(type_t::number), number(n) {}
+    json(const char * str) : type(type_t::string), string(str) {}
+    json(const std::string & str) : type(type_t::string), string(str) {}
+
+    static json make_array(std::vector<json> && elements);
+    static json make_object(std::initializer_list<std::pair<std::string, json>> members);
+
+    bool is_null() const { return type == type_t::null; }
+    // null value if there is no such member
+    const json & operator[](const std::string & key) const;
+    void set(const std::string & key, const json & value);
+    int as_int() const { return static_cast<int>(number); }
+
+    static json parse(const std::string & text);
+    std::string dump() const;
+    void dump_to(std::string & out) const;
+};
+
+} // edsac
+
+
+#endif // JSON_H
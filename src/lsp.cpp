@@ -0,0 +1,294 @@
+#include "lsp.hpp"
+
+#include <sstream>
+#include <filesystem>
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+
+#include "arguments.hpp"
+
+namespace edsac {
+
+// LSP positions count characters in UTF-16 code units, the text is UTF-8
+
+// code units of the character that starts with the byte, 0 for the continuation bytes
+int utf16_units(char c) {
+    unsigned char byte = c;
+    return (byte & 0xc0) == 0x80 ? 0 : byte >= 0xf0 ? 2 : 1;
+}
+
+int line_offset(const std::string & text, int line) {
+    int i = 0, size = text.size();
+    for (; line > 0 && i < size; i++) {
+        if (text[i] == '\n' || (text[i] == '\r' && (i + 1 == size || text[i + 1] != '\n')))
+            line--;
+    }
+    return i;
+}
+
+int offset_of(const std::string & text, int line, int character) {
+    int i = line_offset(text, line), size = text.size();
+    while (character > 0 && i < size && text[i] != '\r' && text[i] != '\n') {
+        character -= utf16_units(text[i++]);
+        while (i < size && !utf16_units(text[i]))
+            i++;
+    }
+    return i;
+}
+
+json position_of(const std::string & text, int offset) {
+    int line = 0, character = 0;
+    for (int i = 0; i < offset; i++) {
+        if (text[i] == '\n' || (text[i] == '\r' && text[i + 1] != '\n')) {
+            line++;
+            character = 0;
+        } else if (text[i] != '\r')
+            character += utf16_units(text[i]);
+    }
+    return json::make_object({ { "line", line }, { "character", character } });
+}
+
+// directory of a file:// document for ~include, empty for other schemes
+std::string directory_of(const std::string & uri) {
+    if (uri.compare(0, 7, "file://"))
+        return "";
+    std::string path;
+    for (size_t i = 7; i < uri.size(); i++) {
+        if (uri[i] == '%' && i + 2 < uri.size() && std::isxdigit(uri[i + 1]) && std::isxdigit(uri[i + 2])) {
+            path += char(std::strtol(uri.substr(i + 1, 2).c_str(), nullptr, 16));
+            i += 2;
+        } else
+            path += uri[i];
+    }
+    // file:///C:/dir/file on Windows
+    if (path.size() > 2 && path[0] == '/' && std::isalpha(path[1]) && path[2] == ':')
+        path.erase(0, 1);
+    return std::filesystem::path(path).parent_path().string();
+}
+
+json range_of(const std::string & text, int begin, int end) {
+    return json::make_object({ { "start", position_of(text, begin) }, { "end", position_of(text, end) } });
+}
+
+bool is_name_char(char c) {
+    return c && !std::isspace(c) && !std::strchr("[]{}(),=:$@/", c);
+}
+
+std::pair<int, int> word_at(const std::string & text, int offset) {
+    int begin = offset, end = offset;
+    while (begin > 0 && is_name_char(text[begin - 1]))
+        begin--;
+    while (end < int(text.size()) && is_name_char(text[end]))
+        end++;
+    return { begin, end };
+}
+
+int find_word(const std::string & text, const std::string & word) {
+    for (size_t at = text.find(word); at != std::string::npos; at = text.find(word, at + 1)) {
+        bool starts = at == 0 || !is_name_char(text[at - 1]);
+        bool ends = at + word.size() == text.size() || !is_name_char(text[at + word.size()]);
+        if (starts && ends)
+            return at;
+    }
+    return -1;
+}
+
+bool language_server::read_message(json & message) {
+    size_t length = 0;
+    std::string header;
+    while (std::getline(input, header)) {
+        if (!header.empty() && header.back() == '\r')
+            header.pop_back();
+        if (header.empty())
+            break;
+        if (!header.compare(0, 15, "Content-Length:"))
+            length = std::strtoul(header.c_str() + 15, nullptr, 10);
+    }
+    if (!input)
+        return false;
+    std::string body(length, '\0');
+    if (!input.read(&body[0], length))
+        return false;
+    message = json::parse(body);
+    return true;
+}
+
+void language_server::send(const json & message) {
+    std::string body = message.dump();
+    output << "Content-Length: " << body.size() << "\r\n\r\n" << body << std::flush;
+}
+
+void language_server::respond(const json & id, const json & result) {
+    send(json::make_object({ { "jsonrpc", "2.0" }, { "id", id }, { "result", result } }));
+}
+
+void language_server::publish_diagnostics(const std::string & uri, document & doc) {
+    std::ostringstream tape, messages;
+    doc.compiler.update(doc.text, tape, messages);
+    std::vector<json> diagnostics;
+    std::istringstream lines(messages.str());
+    std::string message;
+    while (std::getline(lines, message)) {
+        // the same messages parser::parse prints, with an optional line:column position
+        static const char * const kinds[] = { "compilation error", "link time error", "link time warning", "warning" };
+        int severity = 0;
+        const char * rest = nullptr;
+        for (const char * kind : kinds) {
+            size_t n = std::strlen(kind);
+            if (!message.compare(0, n, kind)) {
+                severity = std::strstr(kind, "error") ? 1 : 2;
+                rest = message.c_str() + n;
+                break;
+            }
+        }
+        if (!severity)
+            continue;
+        int begin = 0;
+        if (*rest == ':' && std::isdigit(rest[1])) {
+            char * end;
+            int line = std::strtol(rest + 1, &end, 10);
+            int column = std::strtol(end + 1, &end, 10);
+            rest = end;
+            // the compiler counts columns in bytes
+            begin = line_offset(doc.text, line - 1);
+            for (; column > 1 && begin < int(doc.text.size()) && doc.text[begin] != '\r' && doc.text[begin] != '\n'; column--)
+                begin++;
+        } else {
+            // link errors have no position, point to the name they complain about
+            const char * quote = std::strchr(rest, '\'');
+            const char * close = quote ? std::strchr(quote + 1, '\'') : nullptr;
+            if (close) {
+                int at = find_word(doc.text, std::string(quote + 1, close));
+                if (at >= 0)
+                    begin = at;
+            }
+        }
+        if (*rest == ':')
+            rest++;
+        while (*rest == ' ')
+            rest++;
+        auto word = word_at(doc.text, begin);
+        diagnostics.push_back(json::make_object({
+            { "range", range_of(doc.text, begin, std::max(word.second, begin)) },
+            { "severity", severity },
+            { "source", "edsacc" },
+            { "message", rest }
+        }));
+    }
+    send(json::make_object({
+        { "jsonrpc", "2.0" },
+        { "method", "textDocument/publishDiagnostics" },
+        { "params", json::make_object({ { "uri", uri }, { "diagnostics", json::make_array(std::move(diagnostics)) } }) }
+    }));
+}
+
+json language_server::hover(document & doc, const json & position) {
+    int offset = offset_of(doc.text, position["line"].as_int(), position["character"].as_int());
+    auto word = word_at(doc.text, offset);
+    if (word.first == word.second)
+        return json();
+    std::string name = doc.text.substr(word.first, word.second - word.first);
+    auto & vars = doc.compiler.symbols();
+    auto iter = vars.find(name);
+    if (iter == vars.end())
+        return json();
+    return json::make_object({
+        { "contents", json::make_object({ { "kind", "plaintext" }, { "value", name + " = " + std::to_string(iter->second) } }) },
+        { "range", range_of(doc.text, word.first, word.second) }
+    });
+}
+
+json language_server::definition(const std::string & uri, document & doc, const json & position) {
+    int offset = offset_of(doc.text, position["line"].as_int(), position["character"].as_int());
+    auto word = word_at(doc.text, offset);
+    std::string name = doc.text.substr(word.first, word.second - word.first);
+    // regions are the last version that compiled, their positions can be behind the text while it has errors
+    for (auto & r : doc.compiler.parts()) {
+        for (auto & declaration : r->declarations) {
+            if (declaration.first != name)
+                continue;
+            // declarations are in the text with expanded macros
+            int begin = doc.compiler.input_offset(r->start + declaration.second);
+            return json::make_object({ { "uri", uri }, { "range", range_of(doc.text, begin, begin + int(name.size())) } });
+        }
+    }
+    return json();
+}
+
+void language_server::handle(const json & message) {
+    const std::string & method = message["method"].string;
+    const json & params = message["params"];
+    const json & id = message["id"];
+    const std::string & uri = params["textDocument"]["uri"].string;
+    auto iter = documents.find(uri);
+    document * doc = iter == documents.end() ? nullptr : iter->second.get();
+
+    if (method == "initialize") {
+        json capabilities = json::make_object({
+            { "textDocumentSync", json::make_object({ { "openClose", true }, { "change", 2 } }) },
+            { "hoverProvider", true },
+            { "definitionProvider", true }
+        });
+        respond(id, json::make_object({
+            { "capabilities", capabilities },
+            { "serverInfo", json::make_object({ { "name", "edsacc" }, { "version", compiler_version } }) }
+        }));
+    } else if (method == "shutdown") {
+        shutdown = true;
+        respond(id, json());
+    } else if (method == "textDocument/didOpen") {
+        auto & opened = documents[uri];
+        opened = std::make_unique<document>(io, directory_of(uri));
+        opened->text = params["textDocument"]["text"].string;
+        publish_diagnostics(uri, *opened);
+    } else if (method == "textDocument/didChange" && doc) {
+        for (auto & change : params["contentChanges"].array) {
+            const json & range = change["range"];
+            if (range.is_null()) {
+                doc->text = change["text"].string;
+                continue;
+            }
+            int begin = offset_of(doc->text, range["start"]["line"].as_int(), range["start"]["character"].as_int());
+            int end = offset_of(doc->text, range["end"]["line"].as_int(), range["end"]["character"].as_int());
+            doc->text.replace(begin, end - begin, change["text"].string);
+        }
+        publish_diagnostics(uri, *doc);
+    } else if (method == "textDocument/didClose") {
+        documents.erase(uri);
+    } else if (method == "textDocument/hover") {
+        respond(id, doc ? hover(*doc, params["position"]) : json());
+    } else if (method == "textDocument/definition") {
+        respond(id, doc ? definition(uri, *doc, params["position"]) : json());
+    } else if (!id.is_null()) {
+        send(json::make_object({
+            { "jsonrpc", "2.0" },
+            { "id", id },
+            { "error", json::make_object({ { "code", -32601 }, { "message", "method not found: " + method } }) }
+        }));
+    }
+}
+
+int language_server::run() {
+    while (true) {
+        json message;
+        try {
+            if (!read_message(message))
+                return 1;
+            if (message["method"].string == "exit")
+                return shutdown ? 0 : 1;
+            handle(message);
+        } catch (const std::exception & e) {
+            if (!message["id"].is_null())
+                send(json::make_object({
+                    { "jsonrpc", "2.0" },
+                    { "id", message["id"] },
+                    { "error", json::make_object({ { "code", -32603 }, { "message", e.what() } }) }
+                }));
+        }
+    }
+}
+
+} // edsac
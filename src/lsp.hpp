@@ -0,0 +1,50 @@
+#ifndef LSP_H
+#define LSP_H
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <istream>
+#include <ostream>
+
+#include "incremental.hpp"
+#include "json.hpp"
+
+namespace edsac {
+
+// Language Server Protocol over a pair of streams. Every open document keeps
+// its own incremental_compiler, so an edit only reparses the changed lines.
+class language_server {
+private:
+    struct document {
+        std::string text;
+        incremental_compiler compiler;
+        document(int io, const std::string & directory) : compiler(io, directory) {}
+    };
+
+    std::istream & input;
+    std::ostream & output;
+    std::unordered_map<std::string, std::unique_ptr<document>> documents;
+    // Initial Orders for a document without ~io
+    int io;
+    bool shutdown = false;
+
+    bool read_message(json & message);
+    void send(const json & message);
+    void respond(const json & id, const json & result);
+    void publish_diagnostics(const std::string & uri, document & doc);
+    json hover(document & doc, const json & position);
+    json definition(const std::string & uri, document & doc, const json & position);
+    void handle(const json & message);
+
+public:
+    language_server(std::istream & in, std::ostream & out, int default_io) : input(in), output(out), io(default_io) {}
+
+    // serves requests until the exit notification, returns the process exit code
+    int run();
+};
+
+} // edsac
+
+
+#endif // LSP_H
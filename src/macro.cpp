@@ -0,0 +1,317 @@
+#include "macro.hpp"
+
+#include <cctype>
+#include <algorithm>
+#include <stdexcept>
+
+#include "module.hpp"
+
+namespace edsac {
+
+bool is_word_start(char c) {
+    return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+
+bool is_word_char(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+std::string_view trim(std::string_view str) {
+    while (!str.empty() && std::isspace(static_cast<unsigned char>(str.front())))
+        str.remove_prefix(1);
+    while (!str.empty() && std::isspace(static_cast<unsigned char>(str.back())))
+        str.remove_suffix(1);
+    return str;
+}
+
+void macro_table::define(const std::string & name, macro_t && macro) {
+    macros[name] = std::move(macro);
+    memo.clear();
+}
+
+void macro_table::undefine(const std::string & name) {
+    macros.erase(name);
+    memo.clear();
+}
+
+void macro_table::merge(const macro_table & other) {
+    for (auto & macro : other.macros)
+        macros[macro.first] = macro.second;
+    if (!other.macros.empty())
+        memo.clear();
+}
+
+std::string macro_table::substitute(const macro_t & macro, const std::vector<std::string> & args) const {
+    std::string out;
+    const std::string & body = macro.body;
+    for (size_t i = 0; i < body.size(); ) {
+        if (!is_word_char(body[i])) {
+            out += body[i++];
+            continue;
+        }
+        size_t begin = i;
+        while (i < body.size() && is_word_char(body[i]))
+            i++;
+        std::string_view word(body.data() + begin, i - begin);
+        auto param = std::find(macro.params.begin(), macro.params.end(), word);
+        if (param != macro.params.end())
+            out += args[param - macro.params.begin()];
+        else
+            out += word;
+    }
+    return out;
+}
+
+std::string macro_table::expand(std::string_view text, std::vector<std::string_view> & disabled) {
+    std::string out;
+    for (size_t i = 0; i < text.size(); ) {
+        if (is_word_start(text[i]))
+            expand_word(text, i, out, disabled);
+        else if (is_word_char(text[i])) {
+            // numbers like 5s are not names
+            for (; i < text.size() && is_word_char(text[i]); i++)
+                out += text[i];
+        } else
+            out += text[i++];
+    }
+    return out;
+}
+
+void macro_table::expand_word(std::string_view text, size_t & i, std::string & out, std::vector<std::string_view> & disabled) {
+    size_t begin = i;
+    while (i < text.size() && is_word_char(text[i]))
+        i++;
+    std::string_view word = text.substr(begin, i - begin);
+    auto iter = macros.find(std::string(word));
+    if (iter == macros.end() || std::find(disabled.begin(), disabled.end(), word) != disabled.end()) {
+        out += word;
+        return;
+    }
+    const macro_t & macro = iter->second;
+    std::vector<std::string> args;
+    int lines = 0;
+    if (macro.function) {
+        // a function-like macro without arguments is just a word
+        size_t j = i;
+        while (j < text.size() && std::isspace(static_cast<unsigned char>(text[j])))
+            j++;
+        if (j == text.size() || text[j] != '(') {
+            out += word;
+            return;
+        }
+        std::string arg;
+        for (int depth = 0; ; ) {
+            if (++j == text.size())
+                throw std::runtime_error("arguments of macro '" + iter->first + "' are not closed");
+            char c = text[j];
+            if (c == ')' && depth == 0)
+                break;
+            if (c == ',' && depth == 0) {
+                args.push_back(std::string(trim(arg)));
+                arg.clear();
+                continue;
+            }
+            if (c == '(')
+                depth++;
+            else if (c == ')')
+                depth--;
+            arg += c == '\r' || c == '\n' ? ' ' : c;
+        }
+        args.push_back(std::string(trim(arg)));
+        lines = std::count(text.begin() + i, text.begin() + j, '\n');
+        i = j + 1;
+        if (macro.params.empty() && args.size() == 1 && args[0].empty())
+            args.clear();
+        if (args.size() != macro.params.size())
+            throw std::runtime_error("macro '" + iter->first + "' takes " + std::to_string(macro.params.size()) +
+                " arguments, " + std::to_string(args.size()) + " given");
+    }
+
+    // the same macro with the same arguments is expanded once if it is not inside of another macro
+    bool outer = disabled.empty();
+    std::string key;
+    if (outer) {
+        key = iter->first;
+        for (auto & arg : args) {
+            key += '\0';
+            key += arg;
+        }
+        auto found = memo.find(key);
+        if (found != memo.end()) {
+            out += found->second;
+            out.append(lines, '\n');
+            return;
+        }
+    }
+    for (auto & arg : args)
+        arg = expand(arg, disabled);
+    std::string body = macro.function ? substitute(macro, args) : macro.body;
+    disabled.push_back(iter->first);
+    std::string result = expand(body, disabled);
+    disabled.pop_back();
+    out += result;
+    out.append(lines, '\n');
+    if (outer)
+        memo.emplace(std::move(key), std::move(result));
+}
+
+// ~define and ~undef after the directive word, the text can be continued on the next lines with a backslash
+void define_macro(bool define, std::string_view line, macro_table & macros) {
+    size_t i = 0;
+    while (i < line.size() && std::isspace(static_cast<unsigned char>(line[i])))
+        i++;
+    size_t begin = i;
+    while (i < line.size() && is_word_char(line[i]))
+        i++;
+    if (i == begin || !is_word_start(line[begin]))
+        throw std::runtime_error(std::string("macro name expected after ~") + (define ? "define" : "undef"));
+    std::string name(line.substr(begin, i - begin));
+    if (!define) {
+        if (!trim(line.substr(i)).empty())
+            throw std::runtime_error("unexpected text after ~undef " + name);
+        macros.undefine(name);
+        return;
+    }
+    macro_table::macro_t macro;
+    if (i < line.size() && line[i] == '(') {
+        macro.function = true;
+        size_t close = line.find(')', i);
+        if (close == std::string_view::npos)
+            throw std::runtime_error("parameters of macro '" + name + "' are not closed");
+        std::string_view params = line.substr(i + 1, close - i - 1);
+        while (!trim(params).empty()) {
+            size_t comma = params.find(',');
+            std::string_view param = trim(params.substr(0, comma));
+            if (param.empty() || !is_word_start(param[0]) || !std::all_of(param.begin(), param.end(), is_word_char))
+                throw std::runtime_error("bad parameter '" + std::string(param) + "' of macro '" + name + "'");
+            macro.params.emplace_back(param);
+            if (comma == std::string_view::npos)
+                break;
+            params.remove_prefix(comma + 1);
+            if (trim(params).empty())
+                throw std::runtime_error("parameter expected after ',' in macro '" + name + "'");
+        }
+        i = close + 1;
+    }
+    macro.body = std::string(trim(line.substr(i)));
+    macros.define(name, std::move(macro));
+}
+
+void source_map::add(int text, int source, bool copied) {
+    if (!segments.empty()) {
+        segment & last = segments.back();
+        if (copied && last.copied && last.source + (text - last.text) == source)
+            return;
+        if (last.text == text) {
+            last = { text, source, copied };
+            return;
+        }
+    }
+    segments.push_back({ text, source, copied });
+}
+
+int source_map::source_offset(int text) const {
+    auto iter = std::upper_bound(segments.begin(), segments.end(), text, [](int at, const segment & s) { return at < s.text; });
+    if (iter == segments.begin())
+        return text;
+    --iter;
+    return iter->copied ? iter->source + (text - iter->text) : iter->source;
+}
+
+std::string preprocess(const std::string & text, int & i, macro_table & macros, std::string_view directory, source_map * map) {
+    size_t n = text.size();
+    if (macros.empty() && text.find('~') == std::string::npos)
+        return text;
+    std::string out;
+    out.reserve(n);
+    std::vector<std::string_view> disabled;
+    for (size_t at = 0; at < n; ) {
+        i = at;
+        char c = text[at];
+        bool word_start = at == 0 || std::isspace(static_cast<unsigned char>(text[at - 1]));
+        size_t end = at;
+        if (c == '/' && text[at + 1] == '/') {
+            end = std::min(text.find_first_of("\r\n", at), n);
+        } else if (c == '/' && text[at + 1] == '*') {
+            end = text.find("*/", at + 2);
+            end = end == std::string::npos ? n : end + 2;
+        } else if (c == '[' && word_start) {
+            // edsac comment, but not an array size after '='
+            size_t p = at;
+            while (p > 0 && std::isspace(static_cast<unsigned char>(text[p - 1])))
+                p--;
+            if (p == 0 || text[p - 1] != '=') {
+                end = text.find(']', at);
+                end = end == std::string::npos ? n : end + 1;
+            }
+        } else if (c == '~' && word_start) {
+            size_t j = at + 1;
+            while (j < n && (text[j] == ' ' || text[j] == '\t'))
+                j++;
+            size_t k = j;
+            while (k < n && is_word_char(text[k]))
+                k++;
+            std::string_view directive(text.data() + j, k - j);
+            if (directive == "define" || directive == "undef") {
+                std::string line;
+                int breaks = 0;
+                for (end = k; ; ) {
+                    size_t eol = std::min(text.find_first_of("\r\n", end), n);
+                    std::string_view part(text.data() + end, eol - end);
+                    part = part.substr(0, part.find("//"));
+                    while (!part.empty() && std::isspace(static_cast<unsigned char>(part.back())))
+                        part.remove_suffix(1);
+                    if (part.empty() || part.back() != '\\' || eol == n) {
+                        line += part;
+                        end = eol;
+                        break;
+                    }
+                    line += part.substr(0, part.size() - 1);
+                    line += ' ';
+                    end = eol + (text[eol] == '\r' && text[eol + 1] == '\n' ? 2 : 1);
+                    breaks++;
+                }
+                define_macro(directive == "define", line, macros);
+                // the directive leaves its line breaks, so the lines after it keep their numbers
+                if (map)
+                    map->replace(out.size(), at);
+                out.append(breaks, '\n');
+                at = end;
+                continue;
+            }
+            end = k;
+            if (directive == "include") {
+                size_t q = k;
+                while (q < n && (text[q] == ' ' || text[q] == '\t'))
+                    q++;
+                size_t close = text[q] == '"' ? text.find('"', q + 1) : std::string::npos;
+                if (close != std::string::npos) {
+                    macros.merge(included_macros(text.substr(q + 1, close - q - 1), directory));
+                    end = close + 1;
+                }
+            }
+        } else if (is_word_start(c) && !macros.empty()) {
+            size_t begin = out.size();
+            macros.expand_word(text, at, out, disabled);
+            // a word that is not a macro is copied as it is
+            if (map) {
+                if (out.compare(begin, std::string::npos, text, i, at - i))
+                    map->replace(begin, i);
+                else
+                    map->copy(begin, i);
+            }
+            continue;
+        } else {
+            while (end < n && is_word_char(text[end]))
+                end++;
+        }
+        end = std::max(end, at + 1);
+        if (map)
+            map->copy(out.size(), at);
+        out.append(text, at, end - at);
+        at = end;
+    }
+    return out;
+}
+
+} // edsac
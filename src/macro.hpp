@@ -0,0 +1,68 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+namespace edsac {
+
+// Macros of ~define, object-like "~define N 5" and function-like "~define ADD(x, y) A x F A y F".
+// Arguments are expanded before they are put into the body and the body is expanded again,
+// a macro is not expanded inside of its own expansion.
+class macro_table {
+public:
+    struct macro_t {
+        bool function = false;
+        std::vector<std::string> params;
+        std::string body;
+    };
+
+private:
+    std::unordered_map<std::string, macro_t> macros;
+    // expansions of macros that are not inside of other macros, the key is the name and the arguments
+    std::unordered_map<std::string, std::string> memo;
+
+    std::string expand(std::string_view text, std::vector<std::string_view> & disabled);
+    std::string substitute(const macro_t & macro, const std::vector<std::string> & args) const;
+
+public:
+    bool empty() const { return macros.empty(); }
+    void define(const std::string & name, macro_t && macro);
+    void undefine(const std::string & name);
+    void merge(const macro_table & other);
+    // expands the word at text[i:] and its arguments into out, i goes past them,
+    // lines of the arguments are added as line breaks after the expansion
+    void expand_word(std::string_view text, size_t & i, std::string & out, std::vector<std::string_view> & disabled);
+};
+
+// Offsets of the text made by preprocess in its source. Copied parts keep their offsets,
+// an expansion and the line breaks left by a directive map to where they start in the source.
+class source_map {
+private:
+    struct segment {
+        int text;
+        int source;
+        bool copied;
+    };
+    std::vector<segment> segments;
+
+    void add(int text, int source, bool copied);
+
+public:
+    void copy(int text, int source) { add(text, source, true); }
+    void replace(int text, int source) { add(text, source, false); }
+    // the same offset if nothing was expanded or removed
+    int source_offset(int text) const;
+};
+
+// Removes ~define and ~undef directives and expands macros in the rest of the text, every line stays where it was.
+// Macros of a file included with ~include are defined after the directive, the path is relative to the directory.
+// The map, if it is given, gets the offsets of the result in the text. On exception i points to the place of the error.
+std::string preprocess(const std::string & text, int & i, macro_table & macros, std::string_view directory, source_map * map = nullptr);
+
+} // edsac
+
+
+#endif // MACRO_H
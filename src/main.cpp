@@ -1,38 +1,141 @@
 #include "parser.hpp"
 #include "arguments.hpp"
+#include "cache.hpp"
+#include "incremental.hpp"
+#include "lsp.hpp"
+#include "object.hpp"
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iterator>
+#include <filesystem>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+int compile_cached(std::istream & in, std::ostream & out) {
+    using namespace edsac;
+    std::string text( (std::istreambuf_iterator<char>(in)), (std::istreambuf_iterator<char>()) );
+    // a cache directory that can't be created is not a reason not to compile
+    std::unique_ptr<compile_cache> cache;
+    try {
+        cache = std::make_unique<compile_cache>(arguments.cache);
+    } catch (const std::exception & e) {
+        std::cerr << "warning: " << e.what() << ", compiling without the cache" << std::endl;
+    }
+    // included files are not a part of the key, so programs that include them are compiled every time
+    if (!cache || text.find("~include") != std::string::npos) {
+        std::istringstream source(text);
+        return parser(source, out).parse(std::cerr);
+    }
+    std::string key = compile_cache::key(text, arguments);
+    if (cache->load(key, out))
+        return 0;
+    std::istringstream source(text);
+    std::ostringstream tape, diagnostics;
+    int r = parser(source, tape).parse(diagnostics);
+    std::cerr << diagnostics.str();
+    out << tape.str();
+    // tapes with warnings are not stored, so the warnings are shown on every compilation
+    if (r == 0 && diagnostics.tellp() == 0)
+        cache->store(key, tape.str());
+    return r;
+}
+
+int watch(std::ostream & out) {
+    using namespace edsac;
+    namespace fs = std::filesystem;
+    if (arguments.input.empty())
+        throw std::invalid_argument("--watch requires an input file");
+    incremental_compiler compiler(arguments.io);
+    fs::file_time_type last_change;
+    for (;; std::this_thread::sleep_for(std::chrono::milliseconds(50))) {
+        std::error_code ec;
+        auto change = fs::last_write_time(arguments.input, ec);
+        if (ec || change == last_change)
+            continue;
+        last_change = change;
+        std::ifstream in(arguments.input);
+        std::string text( (std::istreambuf_iterator<char>(in)), (std::istreambuf_iterator<char>()) );
+        std::ostringstream tape;
+        auto start = std::chrono::steady_clock::now();
+        int r = compiler.update(text, tape, std::cerr);
+        auto time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        if (r == 0) {
+            if (arguments.output.empty())
+                out << tape.str() << std::endl;
+            else
+                std::ofstream(arguments.output, arguments.output_mode()) << tape.str();
+        }
+        std::cerr << "[" << arguments.input << (r ? " failed" : " compiled") << " in " << time.count() << " us]" << std::endl;
+    }
+}
 
 int main(int argn, const char ** args) {
     using namespace edsac;
     arguments.init(argn, args);
     if (arguments.help) {
         using namespace std;
-        cout << *args << " [-12dh] [--help] [--io <1|2>] [--debug] [--input <input_filename>] [--output <output_filename>]" << endl;
+        cout << *args << " [-12dhO] [--help] [--io <1|2|1,2>] [--debug] [--input <input_filename>] [--output <output_filename>] [--cache <directory>] [--jobs <n>] [--format <text|image>] [--reserve-arrays] [--optimize] [--bounds-check] [--object] [--link <objects...>] [--watch] [--lsp]" << endl;
         cout << "\t-h, --help             shows this help and quits" << endl;
         cout << "\t-1, --io=1             specify \"Initial Orders 1\" for the program" << endl;
         cout << "\t-2, --io=2             specify \"Initial Orders 2\" for the program (default)" << endl;
+        cout << "\t    --io=1,2           write the program for both Initial Orders, to prog.io1.txt and prog.io2.txt for prog.txt" << endl;
         cout << "\t    --input=<file>     specify program file (will use stdin if not pointed)" << endl;
         cout << "\t    --output=<file>    specify result program for EDSAC Simulator (stdout by default)" << endl;
+        cout << "\t    --cache=<dir>      reuse compilation results stored in the directory" << endl;
+        cout << "\t    --jobs=<n>         number of threads for a big program (one per processor by default)" << endl;
+        cout << "\t    --format=image     output the assembled store and symbols instead of a tape" << endl;
+        cout << "\t    --reserve-arrays   skip zeros of arrays with \"T m K\" instead of loading them (Initial Orders 2)" << endl;
+        cout << "\t-O, --optimize         inline small subroutines called in loops or from a few places" << endl;
+        cout << "\t    --bounds-check     stop the program if an index of a[i] is out of the array" << endl;
+        cout << "\t    --object           write an object file to link later instead of a program" << endl;
+        cout << "\t    --link             link the object files given as arguments into a program" << endl;
+        cout << "\t    --watch            recompile the input file every time it changes" << endl;
+        cout << "\t    --lsp              run as a language server on stdin and stdout" << endl;
         cout << "\t-d, --debug            output some helpfull information in comments within programm" << endl;
         return 0;
     }
+    if (arguments.lsp)
+        return language_server(std::cin, std::cout, arguments.io).run();
+    // images and objects written to stdout must not get '\r' before every '\n' on Windows
+    if (arguments.output.empty() && (arguments.output_mode() & std::ios::binary)) {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    }
+    if (arguments.watch)
+        return watch(std::cout);
     std::istream * in;
     std::ostream * out;
     if (arguments.input.empty())
         in = &std::cin;
     else
         in = new std::ifstream(arguments.input);
-    if (arguments.output.empty())
-        out = &std::cout;
+    // programs for several Initial Orders are written to files named after the output
+    bool own_output = !arguments.output.empty() && arguments.targets.empty();
+    if (own_output)
+        out = new std::ofstream(arguments.output, arguments.output_mode());
     else
-        out = new std::ofstream(arguments.output);
-    edsac::parser p(*in, *out);
-    int r = p.parse(std::cerr);
+        out = &std::cout;
+    int r;
+    if (arguments.link)
+        r = link_objects(arguments.other, *out, std::cerr);
+    else if (arguments.cache.empty() || !arguments.targets.empty()) {
+        edsac::parser p(*in, *out);
+        r = p.parse(std::cerr);
+    } else
+        r = compile_cached(*in, *out);
     if (!arguments.input.empty())
         delete in;
-    if (!arguments.output.empty())
+    if (own_output)
         delete out;
     return r;
 }
@@ -0,0 +1,160 @@
+#include "module.hpp"
+
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <memory>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+#include <system_error>
+#include <stdexcept>
+#include <algorithm>
+
+#include "arguments.hpp"
+#include "macro.hpp"
+
+namespace edsac {
+
+namespace fs = std::filesystem;
+
+module_t::module_t(const std::string & p, const std::string & d, std::string && t, const parse_state & entry) :
+    path(p), directory(d), text(std::move(t)), ctx(text.c_str(), 0, 0, entry, &memory) {}
+
+// a file as it is after macros are expanded in it
+struct source_file {
+    std::string text;
+    macro_table macros;
+    fs::file_time_type time;
+};
+
+std::map<std::string, std::unique_ptr<source_file>> files;
+// files whose macros are being expanded, a file that includes itself does not get its own macros
+std::vector<std::string> loading;
+
+// a file is parsed again only if it is included with another state
+typedef std::tuple<std::string, int, bool, bool, std::vector<const module_t *>> module_key;
+
+std::map<module_key, std::unique_ptr<module_t>> modules;
+// old versions of changed files, states of programs that included them can still refer to them
+std::vector<std::unique_ptr<module_t>> replaced;
+// files can be included by chunks on different threads and by included files
+std::recursive_mutex modules_mutex;
+int units = 0;
+
+std::string resolve_path(const std::string & name, std::string_view directory) {
+    fs::path base = directory.empty() ? fs::path(arguments.input).parent_path() : fs::path(directory);
+    std::error_code ec;
+    std::string path = fs::weakly_canonical(base / name, ec).string();
+    if (ec)
+        throw std::runtime_error("can't find included file \"" + name + "\"");
+    return path;
+}
+
+const source_file & load_file(const std::string & name, const std::string & path) {
+    std::lock_guard<std::recursive_mutex> lock(modules_mutex);
+    std::error_code ec;
+    auto time = fs::last_write_time(path, ec);
+    auto & file = files[path];
+    if (file && file->time == time)
+        return *file;
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("can't open included file \"" + name + "\"");
+    std::string text( (std::istreambuf_iterator<char>(in)), (std::istreambuf_iterator<char>()) );
+    auto loaded = std::make_unique<source_file>();
+    loaded->time = time;
+    loading.push_back(path);
+    int i = 0;
+    try {
+        loaded->text = preprocess(text, i, loaded->macros, fs::path(path).parent_path().string());
+    } catch (const std::exception & e) {
+        loading.pop_back();
+        auto pair = count_lines(text.c_str(), i);
+        throw std::runtime_error("in \"" + name + "\":" + std::to_string(pair.first) + ":" +
+            std::to_string(pair.second) + ": " + e.what());
+    }
+    loading.pop_back();
+    file = std::move(loaded);
+    return *file;
+}
+
+const macro_table & included_macros(const std::string & name, std::string_view directory) {
+    static const macro_table none;
+    std::lock_guard<std::recursive_mutex> lock(modules_mutex);
+    std::string path = resolve_path(name, directory);
+    if (std::find(loading.begin(), loading.end(), path) != loading.end())
+        return none;
+    return load_file(name, path).macros;
+}
+
+bool is_changed(const module_t & module) {
+    for (const module_t * included : module.ctx.state.included) {
+        std::error_code ec;
+        if (fs::last_write_time(included->path, ec) != included->time)
+            return true;
+    }
+    return false;
+}
+
+const module_t & parse_module(const std::string & name, const std::string & path, const parse_state & entry) {
+    std::lock_guard<std::recursive_mutex> lock(modules_mutex);
+    module_key key(path, entry.io, entry.special_vars, entry.has_predicates, entry.included);
+    auto iter = modules.find(key);
+    if (iter != modules.end()) {
+        if (!is_changed(*iter->second))
+            return *iter->second;
+        replaced.push_back(std::move(iter->second));
+        modules.erase(iter);
+    }
+
+    const source_file & file = load_file(name, path);
+    auto module = std::make_unique<module_t>(path, fs::path(path).parent_path().string(), std::string(file.text), entry);
+    module->time = file.time;
+    module->unit = std::to_string(++units) + '.';
+    module->ctx.unit = module->unit;
+    module->ctx.directory = module->directory;
+    module->ctx.state.included.push_back(module.get());
+    int i = 0;
+    try {
+        parse_source(i, module->text.size(), module->ctx);
+    } catch (const std::exception & e) {
+        auto pair = module->ctx.position(i);
+        throw std::runtime_error("in \"" + name + "\":" + std::to_string(pair.first) + ":" +
+            std::to_string(pair.second) + ": " + e.what());
+    }
+    return *modules.emplace(std::move(key), std::move(module)).first->second;
+}
+
+void include_file(const std::string & name, parse_context & ctx) {
+    std::string path = resolve_path(name, ctx.directory);
+    for (const module_t * module : ctx.state.included) {
+        if (module->path == path)
+            return;
+    }
+    parse_state entry = ctx.state;
+    entry.has_predicates = entry.has_predicates || !ctx.predicates.empty();
+    const module_t & module = parse_module(name, path, entry);
+
+    for (auto & p : module.ctx.predicates)
+        ctx.predicates.emplace_back(p->copy(ctx.memory));
+    for (auto & warning : module.ctx.warnings) {
+        if (warning.first < 0) {
+            ctx.warnings.emplace_back(-1, "in \"" + name + "\": " + warning.second);
+        } else {
+            auto pair = module.ctx.position(warning.first);
+            ctx.warnings.emplace_back(-1, "in \"" + name + "\":" + std::to_string(pair.first) + ":" +
+                std::to_string(pair.second) + ": " + warning.second);
+        }
+    }
+    ctx.state = module.ctx.state;
+}
+
+std::vector<std::string_view> source_texts(std::string_view text, const parse_state & state) {
+    std::vector<std::string_view> texts{ text };
+    for (const module_t * module : state.included)
+        texts.push_back(module->text);
+    return texts;
+}
+
+} // edsac
@@ -0,0 +1,43 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory_resource>
+#include <filesystem>
+
+#include "parser.hpp"
+
+namespace edsac {
+
+class macro_table;
+
+// A file included with ~include. It is parsed once for every parser state it is included with
+// and kept for the whole process, includers get copies of its predicates.
+struct module_t {
+    std::string path;
+    std::string directory;
+    std::string text;
+    std::string unit;
+    // the file is parsed again if it changed
+    std::filesystem::file_time_type time;
+    std::pmr::monotonic_buffer_resource memory;
+    parse_context ctx;
+
+    module_t(const std::string & p, const std::string & d, std::string && t, const parse_state & entry);
+};
+
+// macros defined in the file, they are defined in the including file after ~include
+const macro_table & included_macros(const std::string & name, std::string_view directory);
+// ~include "name": puts predicates of the file into ctx, does nothing if the file is already included
+void include_file(const std::string & name, parse_context & ctx);
+// the file or one of the files it includes changed since it was parsed
+bool is_changed(const module_t & module);
+// texts of the program and of the files it includes, names in them are written by the user
+std::vector<std::string_view> source_texts(std::string_view text, const parse_state & state);
+
+} // edsac
+
+
+#endif // MODULE_H
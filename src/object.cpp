@@ -0,0 +1,286 @@
+#include "object.hpp"
+
+#include <fstream>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <unordered_set>
+#include <stdexcept>
+#include <exception>
+
+#include "arguments.hpp"
+#include "optimizer.hpp"
+
+namespace edsac {
+
+void write_string(std::ostream & out, std::string_view str) {
+    out << ' ' << str.size() << ':' << str;
+}
+
+void write_command(std::ostream & out, char tag, const command_predicate & command) {
+    out << tag;
+    write_string(out, std::string_view(&command.prefix, 1));
+    write_string(out, std::string_view(&command.suffics, 1));
+    out << ' ' << command.is_long;
+    if (auto name = std::get_if<std::string_view>(&command.addr))
+        write_string(out, *name);
+    else if (auto expr = std::get_if<expression_t>(&command.addr)) {
+        out << " ~";
+        write_string(out, expr->text);
+    } else
+        out << " =" << std::get<int>(command.addr);
+    out << '\n';
+}
+
+bool is_generated(std::string_view name, const std::vector<std::string_view> & texts) {
+    for (std::string_view text : texts) {
+        if (name.data() >= text.data() && name.data() < text.data() + text.size())
+            return false;
+    }
+    return true;
+}
+
+// a#size and a#stop of --bounds-check are linked like the array a, checks of a[i] in other objects use them
+bool is_array_bound(std::string_view name, const std::unordered_set<std::string_view> & globals) {
+    for (std::string_view suffix : { "#size", "#stop" }) {
+        if (name.size() > suffix.size() && name.substr(name.size() - suffix.size()) == suffix &&
+                globals.count(name.substr(0, name.size() - suffix.size())))
+            return true;
+    }
+    return false;
+}
+
+void write_object(std::ostream & out, const std::vector<predicate_t *> & predicates, const std::vector<std::string_view> & texts, int io) {
+    out << "edsacc object " << object_version << '\n' << "io " << io << '\n';
+    std::unordered_set<std::string_view> globals;
+    for (const predicate_t * p : predicates) {
+        const std::string_view * name = p->definition();
+        if (name && !is_generated(*name, texts))
+            globals.insert(*name);
+    }
+    for (size_t k = 0; k < predicates.size(); k++) {
+        if (is_special_vars(*predicates[k])) {
+            k += special_vars_size - 1;
+            continue;
+        }
+        const std::string_view * name = predicates[k]->definition();
+        if (name && is_generated(*name, texts) && !is_array_bound(*name, globals)) {
+            out << 'l';
+            write_string(out, *name);
+            out << '\n';
+        }
+    }
+    for (size_t k = 0; k < predicates.size(); k++) {
+        const predicate_t * p = predicates[k];
+        if (is_special_vars(*p)) {
+            out << "s\n";
+            k += special_vars_size - 1;
+        } else if (auto var = dynamic_cast<const var_predicate *>(p)) {
+            out << 'v';
+            write_string(out, var->name);
+            out << '\n';
+        } else if (auto inst = dynamic_cast<const inst_predicate *>(p))
+            write_command(out, 'i', *inst);
+        else if (auto direct = dynamic_cast<const direct_predicate *>(p))
+            write_command(out, 'd', *direct);
+        else if (auto constant = dynamic_cast<const const_predicate *>(p)) {
+            out << "c " << constant->count << ' ' << constant->zeros << ' ' << constant->inst.size();
+            for (auto & word : constant->inst)
+                write_string(out, word);
+            out << '\n';
+        } else if (auto ptr = dynamic_cast<const ptr_predicate *>(p)) {
+            out << 'p';
+            write_string(out, ptr->var);
+            out << '\n';
+        } else if (auto expr = dynamic_cast<const expr_predicate *>(p)) {
+            out << 'e';
+            write_string(out, std::string_view(&expr->suffix, 1));
+            write_string(out, expr->expr.text);
+            out << '\n';
+        } else if (auto txt = dynamic_cast<const txt_predicate *>(p)) {
+            out << 't';
+            write_string(out, txt->text);
+            out << '\n';
+        } else
+            throw std::logic_error("predicate can't be written to an object file");
+    }
+}
+
+// predicates of one object file and the arena they live in
+struct object_t {
+    std::pmr::monotonic_buffer_resource memory;
+    parse_context ctx;
+    // generated names are renamed in every object but the first one, so they do not clash
+    std::unordered_map<std::string, std::string_view> locals;
+
+    explicit object_t(const parse_state & state) : ctx("", 0, 0, state, &memory) {}
+};
+
+std::string read_string(std::istream & in) {
+    std::size_t n;
+    if (!(in >> n) || in.get() != ':')
+        throw std::runtime_error("string expected");
+    std::string str(n, '\0');
+    if (n && !in.read(&str[0], n))
+        throw std::runtime_error("unexpected end of file");
+    return str;
+}
+
+char read_char(std::istream & in) {
+    std::string str = read_string(in);
+    if (str.size() != 1)
+        throw std::runtime_error("one character expected");
+    return str[0];
+}
+
+template <typename T>
+T read_value(std::istream & in) {
+    T value;
+    if (!(in >> value))
+        throw std::runtime_error("number expected");
+    return value;
+}
+
+std::string_view read_name(std::istream & in, object_t & object) {
+    std::string name = read_string(in);
+    auto iter = object.locals.find(name);
+    if (iter != object.locals.end())
+        return iter->second;
+    return object.ctx.join({ name });
+}
+
+// expressions have only names written by the user, they are not renamed
+expression_t read_expression(std::istream & in, object_t & object) {
+    std::string_view text = object.ctx.join({ read_string(in), std::string_view("", 1) });
+    expression_t expr;
+    if (parse_expression(text.data(), object.ctx, expr, true) != int(text.size()) - 1)
+        throw std::runtime_error("bad expression '" + std::string(text.data()) + "'");
+    return expr;
+}
+
+void read_command(std::istream & in, object_t & object, bool direct) {
+    char prefix = read_char(in);
+    char suffics = read_char(in);
+    bool is_long = read_value<int>(in);
+    std::variant<std::string_view, int, expression_t> addr;
+    in >> std::ws;
+    if (in.peek() == '=') {
+        in.get();
+        addr = read_value<int>(in);
+    } else if (in.peek() == '~') {
+        in.get();
+        addr = read_expression(in, object);
+    } else
+        addr = read_name(in, object);
+    if (direct)
+        object.ctx.add<direct_predicate>(prefix, addr, suffics, is_long);
+    else
+        object.ctx.add<inst_predicate>(prefix, addr, suffics, is_long);
+}
+
+std::unique_ptr<object_t> read_object(std::istream & in, size_t number, parse_state & state) {
+    std::string word;
+    if (!(in >> word) || word != "edsacc" || !(in >> word) || word != "object")
+        throw std::runtime_error("not an object file");
+    if (read_value<int>(in) != object_version)
+        throw std::runtime_error("object file of another version of edsacc");
+    if (!(in >> word) || word != "io")
+        throw std::runtime_error("io expected");
+    int io = read_value<int>(in);
+    if (io != 1 && io != 2)
+        throw std::runtime_error("unsupported specification: Initial Orders " + std::to_string(io));
+    if (number == 0)
+        state.io = io;
+    else if (io != state.io)
+        throw std::runtime_error("Initial Orders " + std::to_string(io) + " differ from Initial Orders " +
+            std::to_string(state.io) + " of the first object");
+
+    auto object = std::make_unique<object_t>(state);
+    parse_context & ctx = object->ctx;
+    for (char tag; in >> tag; ) {
+        switch (tag) {
+            case 'l': {
+                std::string name = read_string(in);
+                object->locals[name] = number ? ctx.join({ name, "#", std::to_string(number) }) : ctx.join({ name });
+                break;
+            }
+            case 'v': ctx.add<var_predicate>(read_name(in, *object)); break;
+            case 'i': read_command(in, *object, false); break;
+            case 'd': read_command(in, *object, true); break;
+            case 'c': {
+                int count = read_value<int>(in);
+                int zeros = read_value<int>(in);
+                std::pmr::vector<std::pmr::string> words(&object->memory);
+                for (size_t n = read_value<size_t>(in); n > 0; n--)
+                    words.emplace_back(read_string(in));
+                ctx.add<const_predicate>(std::move(words), count, zeros);
+                break;
+            }
+            case 'p': ctx.add<ptr_predicate>(read_name(in, *object)); break;
+            case 'e': {
+                char suffix = read_char(in);
+                ctx.add<expr_predicate>(read_expression(in, *object), suffix);
+                break;
+            }
+            case 't': ctx.add<txt_predicate>(ctx.join({ read_string(in) })); break;
+            case 's': create_edsacc_vars(ctx); break;
+            default:
+                throw std::runtime_error(std::string("unknown predicate '") + tag + "'");
+        }
+    }
+    if (!in.eof())
+        throw std::runtime_error("unexpected end of file");
+    state = ctx.state;
+    return object;
+}
+
+int link_objects(const std::vector<std::string> & files, std::ostream & out, std::ostream & err) {
+    edsac::err = &err;
+    std::vector<std::unique_ptr<object_t>> objects;
+    parse_state state{ arguments.io };
+    std::pmr::monotonic_buffer_resource memory;
+    try {
+        if (files.empty())
+            throw std::invalid_argument("no object files to link");
+        for (size_t k = 0; k < files.size(); k++) {
+            std::ifstream in(files[k], std::ios::binary);
+            if (!in)
+                throw std::runtime_error("can't open object file '" + files[k] + "'");
+            try {
+                objects.push_back(read_object(in, k, state));
+            } catch (const std::exception & e) {
+                throw std::runtime_error(files[k] + ": " + e.what());
+            }
+        }
+        arguments.io = state.io;
+
+        // objects are placed one after another in the order of the files
+        vars_t vars(&memory);
+        std::vector<predicate_t *> all;
+        int last = base_address(arguments.io);
+        for (auto & object : objects)
+            for (auto & p : object->ctx.predicates)
+                all.push_back(p.get());
+        // checks of a[i] are in the objects compiled with --bounds-check
+        bounds_checks_t checks;
+        eliminate_bounds_checks(all, checks);
+        if (arguments.debug && !checks.empty())
+            err << checks << std::endl;
+        if (arguments.optimize)
+            inline_subroutines(all, &memory, arguments.io);
+        if (!arguments.targets.empty()) {
+            link_targets(all, out, arguments.jobs);
+            return 0;
+        }
+        for (auto & p : all)
+            last = p->initialize(last, vars);
+        define_constants(vars, last, arguments.io);
+        link(all, vars, arguments.io, out, arguments.jobs);
+    } catch (const std::exception & e) {
+        err << "link time error: " << e.what() << std::endl;
+        return 2;
+    }
+    return 0;
+}
+
+} // edsac
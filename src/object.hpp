@@ -0,0 +1,40 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parser.hpp"
+
+namespace edsac {
+
+// Object files keep predicates of a program as they are after parsing, before the names get addresses.
+// Addresses, the relocation offset of G K and G Z orders and names are resolved when objects are linked,
+// so a library is compiled once and linked into many programs.
+//
+// The format is text, one predicate per line, strings are written as <length>:<bytes>:
+//   edsacc object <version>
+//   io <1|2>
+//   l <name>                                  name generated by the compiler, it is local to the object
+//   v <name>                                  label
+//   i|d <prefix> <suffix> <long> =<number>    order with an address, d for directives of Initial Orders 2
+//   i|d <prefix> <suffix> <long> <name>       order with a name
+//   i|d <prefix> <suffix> <long> ~<expression> order with an address expression of names
+//   c <count> <zeros> <n> <word>...           constant, n words of the tape and zeros after them
+//   p <name>                                  pointer to the array after it
+//   e <suffix> <expression>                   constant with a value of an expression of names
+//   t <text>                                  not parsed text
+//   s                                         cells of ~use_special_vars, only the first object that has them keeps them
+constexpr int object_version = 2;
+
+// names that are not views of the texts are generated by the compiler
+void write_object(std::ostream & out, const std::vector<predicate_t *> & predicates, const std::vector<std::string_view> & texts, int io);
+// links objects in the given order and writes the program to out, returns the same codes as parser::parse
+int link_objects(const std::vector<std::string> & files, std::ostream & out, std::ostream & err);
+
+} // edsac
+
+
+#endif // OBJECT_H
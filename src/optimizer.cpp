@@ -0,0 +1,371 @@
+#include "optimizer.hpp"
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <variant>
+#include <new>
+#include <stdexcept>
+#include <charconv>
+#include <cctype>
+
+namespace edsac {
+
+// sub ... endsub as parse_source generates it:
+//   E skip, G skip, name:, A link, T return, body, return:, E 0, link:, U 2, skip:
+struct subroutine_t {
+    std::string_view name;
+    std::string_view skip;
+    std::string_view ret;
+    size_t begin;
+    size_t body;
+    // label of the return cell, the body ends before it
+    size_t ret_at;
+    size_t end;
+    // words of the body and of the whole subroutine
+    int size = 0;
+    int closed_size = 0;
+    bool inlinable = true;
+    // the name is used not only by calls, so the subroutine is kept
+    bool referenced = false;
+    size_t calls = 0;
+    size_t inlined = 0;
+    // labels and arrays of the body, they are renamed in every copy
+    std::unordered_set<std::string_view> locals;
+};
+
+// link:, A link, G name
+struct call_t {
+    size_t at;
+    std::string_view link;
+    std::string_view name;
+    bool loop;
+    subroutine_t * sub = nullptr;
+};
+
+std::string_view order_name(const predicate_t * p, char prefix) {
+    auto command = dynamic_cast<const command_predicate *>(p);
+    if (!command || command->prefix != prefix)
+        return {};
+    auto name = std::get_if<std::string_view>(&command->addr);
+    return name ? *name : std::string_view();
+}
+
+std::string_view label_name(const predicate_t * p) {
+    auto var = dynamic_cast<const var_predicate *>(p);
+    return var ? var->name : std::string_view();
+}
+
+bool has_prefix(std::string_view str, std::string_view prefix) {
+    return str.substr(0, prefix.size()) == prefix;
+}
+
+std::string_view join_names(std::pmr::memory_resource * memory, std::string_view a, std::string_view b) {
+    char * result = static_cast<char *>(memory->allocate(a.size() + b.size(), 1));
+    std::copy(b.begin(), b.end(), std::copy(a.begin(), a.end(), result));
+    return std::string_view(result, a.size() + b.size());
+}
+
+// finds sub at predicates[k], end is 0 if there is none
+subroutine_t find_subroutine(const std::vector<predicate_t *> & predicates, size_t k) {
+    subroutine_t sub;
+    sub.end = 0;
+    size_t n = predicates.size();
+    sub.skip = order_name(predicates[k], 'E');
+    if (!has_prefix(sub.skip, sub_prefix) || k + 5 > n || order_name(predicates[k + 1], 'G') != sub.skip)
+        return sub;
+    sub.name = label_name(predicates[k + 2]);
+    auto link = dynamic_cast<const command_predicate *>(predicates[k + 3]);
+    sub.ret = order_name(predicates[k + 4], 'T');
+    if (sub.name.empty() || !link || link->prefix != 'A' || !has_prefix(sub.ret, sub_prefix))
+        return sub;
+    sub.begin = k;
+    sub.body = k + 5;
+    for (sub.ret_at = sub.body; sub.ret_at < n && label_name(predicates[sub.ret_at]) != sub.ret; sub.ret_at++);
+    size_t end = sub.ret_at;
+    for (; end < n && label_name(predicates[end]) != sub.skip; end++);
+    if (end < n)
+        sub.end = end + 1;
+    return sub;
+}
+
+bool inline_subroutines(std::vector<predicate_t *> & predicates, std::pmr::memory_resource * memory, int io) {
+    size_t n = predicates.size();
+    std::vector<subroutine_t> subs;
+    std::vector<call_t> calls;
+    for (size_t k = 0; k < n; k++) {
+        std::string_view link = label_name(predicates[k]);
+        if (has_prefix(link, call_prefix) && k + 2 < n && order_name(predicates[k + 1], 'A') == link) {
+            std::string_view name = order_name(predicates[k + 2], 'G');
+            if (!name.empty())
+                calls.push_back({ k, link, name, has_prefix(link, call_loop_prefix) });
+            continue;
+        }
+        subroutine_t sub = find_subroutine(predicates, k);
+        if (sub.end != 0)
+            subs.push_back(std::move(sub));
+    }
+    if (calls.empty() || subs.empty())
+        return false;
+
+    // predicates that use every name
+    std::unordered_map<std::string_view, std::vector<size_t>> users;
+    vars_t scratch;
+    int total = 0;
+    std::vector<int> words(n);
+    for (size_t k = 0; k < n; k++) {
+        names_t names = predicates[k]->references();
+        for (auto name = names.first; name != names.second; ++name)
+            users[*name].push_back(k);
+        if (!predicates[k]->definition())
+            words[k] = predicates[k]->initialize(0, scratch);
+        total += words[k];
+    }
+
+    std::unordered_map<std::string_view, subroutine_t *> by_name;
+    for (auto & sub : subs) {
+        by_name.emplace(sub.name, &sub);
+        for (size_t k = sub.begin; k < sub.end; k++) {
+            (k >= sub.body && k < sub.ret_at ? sub.size : sub.closed_size) += words[k];
+            if (k < sub.body || k >= sub.ret_at)
+                continue;
+            const predicate_t * p = predicates[k];
+            if (const std::string_view * name = p->definition())
+                sub.locals.insert(*name);
+            else if (auto ptr = dynamic_cast<const ptr_predicate *>(p))
+                sub.locals.insert(ptr->var);
+            // a copy of a call would call the subroutine that can be removed, G K changes the relocation
+            if (has_prefix(label_name(p), call_prefix) || is_position_dependent(*p))
+                sub.inlinable = false;
+        }
+        sub.closed_size += sub.size;
+    }
+    for (auto & call : calls) {
+        auto iter = by_name.find(call.name);
+        if (iter == by_name.end())
+            continue;
+        call.sub = iter->second;
+        call.sub->calls++;
+    }
+
+    auto is_call = [&](size_t k, std::string_view name) {
+        auto call = std::lower_bound(calls.begin(), calls.end(), k - 2, [](const call_t & c, size_t at) { return c.at < at; });
+        return call != calls.end() && call->at + 2 == k && call->name == name;
+    };
+    for (auto & sub : subs) {
+        // the body can use its labels and the return cell only by jumps, it is left by a jump to the return cell
+        for (size_t k = sub.body; k < sub.ret_at && sub.inlinable; k++) {
+            const predicate_t * p = predicates[k];
+            names_t names = p->references();
+            auto command = dynamic_cast<const command_predicate *>(p);
+            bool renamed = dynamic_cast<const ptr_predicate *>(p) || (command && std::holds_alternative<std::string_view>(command->addr));
+            for (auto name = names.first; name != names.second; ++name) {
+                if (*name == sub.name || *name == sub.skip)
+                    sub.inlinable = false;
+                else if (*name == sub.ret && (!command || (command->prefix != 'E' && command->prefix != 'G')))
+                    sub.inlinable = false;
+                else if (sub.locals.count(*name) && !renamed)
+                    sub.inlinable = false;
+            }
+        }
+        for (std::string_view local : sub.locals) {
+            for (size_t k : users[local]) {
+                if (k < sub.body || k >= sub.ret_at)
+                    sub.inlinable = false;
+            }
+        }
+        for (std::string_view name : { sub.name, sub.skip, sub.ret }) {
+            for (size_t k : users[name]) {
+                if ((k < sub.begin || k >= sub.end) && !is_call(k, sub.name))
+                    sub.referenced = true;
+            }
+        }
+    }
+
+    // calls inside of loops go first, then calls of smaller subroutines
+    std::vector<call_t *> candidates;
+    for (auto & call : calls) {
+        subroutine_t * sub = call.sub;
+        if (sub && sub->inlinable && sub->size <= inline_size && (call.loop || sub->calls <= inline_calls))
+            candidates.push_back(&call);
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [](const call_t * a, const call_t * b) {
+        return a->loop != b->loop ? a->loop : a->sub->size < b->sub->size;
+    });
+    int budget = store_size - base_address(io);
+    std::unordered_set<size_t> inlined;
+    for (call_t * call : candidates) {
+        subroutine_t * sub = call->sub;
+        // the body replaces A and G of the call
+        int growth = sub->size - 2;
+        bool removed = !sub->referenced && sub->inlined + 1 == sub->calls;
+        if (removed)
+            growth -= sub->closed_size;
+        if (total + growth > budget)
+            continue;
+        total += growth;
+        sub->inlined++;
+        inlined.insert(call->at);
+    }
+    if (inlined.empty())
+        return false;
+
+    std::unordered_map<size_t, const subroutine_t *> removed;
+    for (auto & sub : subs) {
+        if (!sub.referenced && sub.inlined > 0 && sub.inlined == sub.calls)
+            removed.emplace(sub.begin, &sub);
+    }
+    std::vector<predicate_t *> result;
+    result.reserve(n);
+    size_t next_call = 0;
+    for (size_t k = 0; k < n; ) {
+        auto sub = removed.find(k);
+        if (sub != removed.end()) {
+            k = sub->second->end;
+            continue;
+        }
+        for (; next_call < calls.size() && calls[next_call].at < k; next_call++);
+        if (next_call == calls.size() || calls[next_call].at != k || !inlined.count(k)) {
+            result.push_back(predicates[k++]);
+            continue;
+        }
+        const call_t & call = calls[next_call];
+        // names of the copy end with the name of the call, the return jumps go to the end of the copy
+        std::unordered_map<std::string_view, std::string_view> names;
+        std::string_view end = join_names(memory, call.link, "#end");
+        names.emplace(call.sub->ret, end);
+        for (std::string_view local : call.sub->locals)
+            names.emplace(local, join_names(memory, join_names(memory, local, "#"), call.link));
+        for (size_t q = call.sub->body; q < call.sub->ret_at; q++) {
+            predicate_t * copy = predicates[q]->copy(memory);
+            if (auto var = dynamic_cast<var_predicate *>(copy))
+                var->name = names.at(var->name);
+            else if (auto ptr = dynamic_cast<ptr_predicate *>(copy))
+                ptr->var = names.at(ptr->var);
+            else if (auto command = dynamic_cast<command_predicate *>(copy)) {
+                if (auto name = std::get_if<std::string_view>(&command->addr)) {
+                    auto iter = names.find(*name);
+                    if (iter != names.end())
+                        command->addr = iter->second;
+                }
+            }
+            result.push_back(copy);
+        }
+        result.push_back(new (memory->allocate(sizeof(var_predicate), alignof(var_predicate))) var_predicate(end));
+        k += 3;
+    }
+    predicates = std::move(result);
+    return true;
+}
+
+// value of a word as write_word writes it, -1 if it is not one
+int word_value(std::string_view word) {
+    size_t letter = word.empty() ? std::string_view::npos : char_table.find(word[0]);
+    // words of both Initial Orders, F and S are short, D and L are long
+    bool is_long = !word.empty() && (word.back() == long_suffix(2) || word.back() == long_suffix(1));
+    if (word.size() < 3 || letter == std::string_view::npos ||
+            (!is_long && word.back() != short_suffix(2) && word.back() != short_suffix(1)))
+        return -1;
+    int number = 0;
+    for (char c : word.substr(1, word.size() - 2)) {
+        if (!std::isdigit(c))
+            return -1;
+        number = number * 10 + (c - '0');
+    }
+    return int(letter) << 12 | number << 1 | is_long;
+}
+
+// b of bounds#below#b#... and bounds#index#b#...
+int bound_of(std::string_view label, std::string_view prefix) {
+    int bound = 0;
+    label.remove_prefix(prefix.size());
+    std::from_chars(label.data(), label.data() + label.size(), bound);
+    return bound;
+}
+
+bool eliminate_bounds_checks(std::vector<predicate_t *> & predicates, bounds_checks_t & checks) {
+    size_t n = predicates.size();
+    std::unordered_map<std::string_view, size_t> labels;
+    for (size_t k = 0; k < n; k++) {
+        std::string_view label = label_name(predicates[k]);
+        if (!label.empty())
+            labels.emplace(label, k);
+    }
+    // the array has its size after the label, -1 if the name is not an array
+    auto size_of = [&](std::string_view label) {
+        auto iter = labels.find(label);
+        if (iter == labels.end() || iter->second + 1 >= n)
+            return -1;
+        auto size = dynamic_cast<const const_predicate *>(predicates[iter->second + 1]);
+        return size && size->inst.size() == 1 ? word_value(size->inst[0]) : -1;
+    };
+
+    std::vector<char> removed(n);
+    // sizes used by the checks that are kept
+    std::unordered_set<std::string_view> used;
+    for (size_t k = 0; k < n; k++) {
+        std::string_view label = label_name(predicates[k]);
+        if (has_prefix(label, index_prefix) && k + 1 < n) {
+            // T tmp, bounds#index#b#..., A a, ...
+            std::string_view array = order_name(predicates[k + 1], 'A');
+            int size = size_of(std::string(array) + "#size");
+            int bound = bound_of(label, index_prefix);
+            if (size < 0) {
+                checks.unknown++;
+                continue;
+            }
+            if (bound > size)
+                throw std::runtime_error("index " + std::to_string(bound - 1) + " is out of bounds of array '" +
+                    std::string(array) + "' of " + std::to_string(size) + " elements");
+            checks.eliminated++;
+            continue;
+        }
+        bool below = has_prefix(label, below_prefix);
+        if ((!below && !has_prefix(label, check_prefix)) || k + 5 >= n)
+            continue;
+        // A i, S size, E stop, A size, G stop
+        std::string_view size_name = order_name(predicates[k + 2], 'S');
+        std::string_view stop_name = order_name(predicates[k + 3], 'E');
+        if (order_name(predicates[k + 1], 'A').empty() || size_name.empty() || stop_name.empty() ||
+                order_name(predicates[k + 4], 'A') != size_name || order_name(predicates[k + 5], 'G') != stop_name)
+            continue;
+        int size = size_of(size_name);
+        if (size >= 0 && !(below && bound_of(label, below_prefix) <= size)) {
+            checks.kept++;
+            used.insert(size_name);
+            continue;
+        }
+        (size < 0 ? checks.unknown : checks.eliminated)++;
+        std::fill(removed.begin() + k + 2, removed.begin() + k + 6, true);
+    }
+    // a#size:, P n F, a#stop:, Z 0 F of arrays without checks
+    for (size_t k = 0; k + 3 < n; k++) {
+        std::string_view label = label_name(predicates[k]);
+        if (label.find("#size") == std::string_view::npos || used.count(label) || size_of(label) < 0 ||
+                label_name(predicates[k + 2]).empty())
+            continue;
+        auto stop = dynamic_cast<const command_predicate *>(predicates[k + 3]);
+        if (stop && stop->prefix == 'Z')
+            std::fill(removed.begin() + k, removed.begin() + k + 4, true);
+    }
+    if (std::find(removed.begin(), removed.end(), true) == removed.end())
+        return false;
+    size_t last = 0;
+    for (size_t k = 0; k < n; k++) {
+        if (!removed[k])
+            predicates[last++] = predicates[k];
+    }
+    predicates.resize(last);
+    return true;
+}
+
+std::ostream & operator<<(std::ostream & out, const bounds_checks_t & checks) {
+    out << "bounds checks: " << checks.kept << " kept, " << checks.eliminated << " eliminated";
+    if (checks.unknown > 0)
+        out << ", " << checks.unknown << " not checked (indexed names that are not arrays)";
+    return out;
+}
+
+} // edsac
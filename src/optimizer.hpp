@@ -0,0 +1,42 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <vector>
+#include <memory_resource>
+#include <ostream>
+
+#include "parser.hpp"
+
+namespace edsac {
+
+// Subroutines of sub ... endsub with at most this many words in the body are inlined by -O
+constexpr int inline_size = 16;
+// calls outside of loops are inlined only if the subroutine has at most that many calls
+constexpr int inline_calls = 3;
+
+// Replaces calls of small subroutines with copies of their bodies, calls inside of loops first,
+// while the program fits into the store. A subroutine that is not called any more and is not
+// referenced by name is removed. Copies and their generated names are allocated in memory.
+// Returns true if predicates changed.
+bool inline_subroutines(std::vector<predicate_t *> & predicates, std::pmr::memory_resource * memory, int io);
+
+// bounds checks of a[i] made by --bounds-check
+struct bounds_checks_t {
+    int kept = 0;
+    int eliminated = 0;
+    // a[i] of names that are not arrays, they are not checked
+    int unknown = 0;
+
+    bool empty() const { return kept + eliminated + unknown == 0; }
+};
+
+// Removes the checks of indexes that are known to be in the array and the sizes of arrays without checks.
+// Throws if a constant index is out of its array. Returns true if predicates changed.
+bool eliminate_bounds_checks(std::vector<predicate_t *> & predicates, bounds_checks_t & checks);
+// "bounds checks: 2 kept, 3 eliminated", and ", 1 not checked (...)" if some indexed names are not arrays
+std::ostream & operator<<(std::ostream & out, const bounds_checks_t & checks);
+
+} // edsac
+
+
+#endif // OPTIMIZER_H
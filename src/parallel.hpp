@@ -0,0 +1,31 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+namespace edsac {
+
+// Calls body(k) for every k in [0:n) on up to jobs threads, the calling thread is one of them.
+// The body must not throw.
+template <typename F>
+void parallel_for(std::size_t n, unsigned jobs, F body) {
+    std::atomic<std::size_t> next(0);
+    auto work = [&] {
+        for (std::size_t k; (k = next++) < n; )
+            body(k);
+    };
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < jobs && t < n; t++)
+        threads.emplace_back(work);
+    work();
+    for (auto & thread : threads)
+        thread.join();
+}
+
+} // edsac
+
+
+#endif // PARALLEL_H
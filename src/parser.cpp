@@ -11,19 +11,25 @@
 #include <utility>
 #include <tuple>
 #include <sstream>
+#include <algorithm>
+#include <numeric>
+#include <exception>
+#include <charconv>
+#include <fstream>
+#include <filesystem>
 
 #include "arguments.hpp"
+#include "parallel.hpp"
+#include "image.hpp"
+#include "object.hpp"
+#include "module.hpp"
+#include "macro.hpp"
+#include "optimizer.hpp"
 
 namespace edsac {
 
 thread_local std::ostream * err;
-
-struct predicate_t {
-	virtual int initialize(int inst_n, std::unordered_map<std::string, int> & vars) = 0;
-	virtual void resolve(const std::unordered_map<std::string, int> & vars) = 0;
-	virtual std::ostream & write_to(std::ostream & out) const = 0;
-	virtual ~predicate_t() {}
-};
+thread_local int target_io = 2;
 
 template <typename T>
 T min(T a, T b) {
@@ -83,8 +89,240 @@ int read_int(const char * str, int & value) {
 	return i;
 }
 
-static bool is_tmp_not_created = true;
+int apply_operator(char op, int a, int b, std::string_view text) {
+	switch (op) {
+	case '+': return int(unsigned(a) + unsigned(b));
+	case '-': return int(unsigned(a) - unsigned(b));
+	case '*': return int(unsigned(a) * unsigned(b));
+	case '/':
+		if (b == 0)
+			throw std::runtime_error("division by zero in expression '" + std::string(text) + "'");
+		return a / b;
+	case '<':
+	case '>':
+		if (b < 0 || b > 31)
+			throw std::runtime_error("shift by " + std::to_string(b) + " in expression '" + std::string(text) + "'");
+		return op == '<' ? int(unsigned(a) << b) : a >> b;
+	}
+	throw std::logic_error("unknown operator in expression");
+}
+
+// Recursive descent over the expression, constant operands are folded as soon as their operator is read,
+// so an expression without names becomes one number.
+class expression_parser {
+private:
+	const char * str;
+	bool spaces;
+	int i = 0;
+	int depth = 0;
+	std::vector<expression_t::op_t> ops;
+	std::vector<std::string_view> names;
+
+	void skip() {
+		if (spaces || depth > 0)
+			skip_space(str, i);
+	}
+
+	// operator after an operand, 0 if the expression ends there, it starts at str[at]
+	char peek_operator(int & at) {
+		at = i;
+		if (spaces || depth > 0)
+			skip_space(str, at);
+		char c = str[at];
+		if ((c == '+' || c == '-' || c == '*') || (c == '/' && str[at + 1] != '/' && str[at + 1] != '*'))
+			return c;
+		if ((c == '<' || c == '>') && str[at + 1] == c)
+			return c;
+		return 0;
+	}
+
+	void apply(char op) {
+		size_t n = ops.size();
+		if (op == '_') {
+			if (ops.back().kind == 'n')
+				ops.back().value = int(0u - unsigned(ops.back().value));
+			else
+				ops.push_back({ op, 0 });
+		} else if (ops[n - 1].kind == 'n' && ops[n - 2].kind == 'n') {
+			ops[n - 2].value = apply_operator(op, ops[n - 2].value, ops[n - 1].value, std::string_view(str, i));
+			ops.pop_back();
+		} else
+			ops.push_back({ op, 0 });
+	}
+
+	void primary() {
+		skip();
+		char c = str[i];
+		if (c == '(') {
+			i++;
+			depth++;
+			shift();
+			skip();
+			if (str[i] != ')')
+				throw std::runtime_error("closing ')' expected in expression");
+			i++;
+			depth--;
+		} else if (c == '-' || c == '+') {
+			i++;
+			primary();
+			if (c == '-')
+				apply('_');
+		} else if (std::isdigit(c)) {
+			long long value = 0;
+			for (; std::isdigit(str[i]); i++) {
+				value = value * 10 + str[i] - '0';
+				if (value > 0x7fffffff)
+					throw std::runtime_error("number is too big in expression");
+			}
+			ops.push_back({ 'n', int(value) });
+		} else if (std::isalpha(c) || c == '_') {
+			int begin = i;
+			for (; std::isalnum(str[i]) || str[i] == '_'; i++);
+			std::string_view name(str + begin, i - begin);
+			auto iter = std::find(names.begin(), names.end(), name);
+			ops.push_back({ 'v', int(iter - names.begin()) });
+			if (iter == names.end())
+				names.push_back(name);
+		} else if (c == 0)
+			throw std::runtime_error("unexpected end of expression");
+		else
+			throw std::runtime_error(std::string("unexpected character in expression '") + c + "'");
+	}
+
+	void product() {
+		primary();
+		for (int at; char op = peek_operator(at); ) {
+			if (op != '*' && op != '/')
+				break;
+			i = at + 1;
+			primary();
+			apply(op);
+		}
+	}
+
+	void sum() {
+		product();
+		for (int at; char op = peek_operator(at); ) {
+			if (op != '+' && op != '-')
+				break;
+			i = at + 1;
+			product();
+			apply(op);
+		}
+	}
+
+	void shift() {
+		sum();
+		for (int at; char op = peek_operator(at); ) {
+			if (op != '<' && op != '>')
+				break;
+			i = at + 2;
+			sum();
+			apply(op);
+		}
+	}
+
+public:
+	expression_parser(const char * s, bool sp) : str(s), spaces(sp) {}
+
+	int parse(parse_context & ctx, expression_t & expr) {
+		shift();
+		expr.text = std::string_view(str, i);
+		expr.size = ops.size();
+		auto p = static_cast<expression_t::op_t *>(ctx.memory->allocate(sizeof(expression_t::op_t) * ops.size(), alignof(expression_t::op_t)));
+		expr.ops = std::copy(ops.begin(), ops.end(), p) - ops.size();
+		expr.names_size = names.size();
+		expr.names = nullptr;
+		if (!names.empty()) {
+			auto q = static_cast<std::string_view *>(ctx.memory->allocate(sizeof(std::string_view) * names.size(), alignof(std::string_view)));
+			expr.names = std::uninitialized_copy(names.begin(), names.end(), q) - names.size();
+		}
+		return i;
+	}
+};
+
+int parse_expression(const char * str, parse_context & ctx, expression_t & expr, bool spaces) {
+	return expression_parser(str, spaces).parse(ctx, expr);
+}
+
+// value of an expression that must be known when it is parsed
+int constant_value(const expression_t & expr, const char * what) {
+	if (expr.names_size > 0)
+		throw std::runtime_error(std::string(what) + " must be a constant expression, '" + std::string(expr.text) + "' has names");
+	return expr.ops[0].value;
+}
+
+// runs the postfix program, value_of gives values of names by their indexes
+template <typename Value>
+int run_expression(const expression_t & expr, Value value_of) {
+	int small[16];
+	std::vector<int> large;
+	int * stack = small;
+	if (expr.size > 16) {
+		large.resize(expr.size);
+		stack = large.data();
+	}
+	int n = 0;
+	for (const expression_t::op_t * op = expr.ops; op != expr.ops + expr.size; op++) {
+		switch (op->kind) {
+		case 'n':
+			stack[n++] = op->value;
+			break;
+		case 'v':
+			stack[n++] = value_of(op->value);
+			break;
+		case '_':
+			stack[n - 1] = int(0u - unsigned(stack[n - 1]));
+			break;
+		default:
+			n--;
+			stack[n - 1] = apply_operator(op->kind, stack[n - 1], stack[n], expr.text);
+		}
+	}
+	return stack[0];
+}
+
+int expression_t::evaluate(const vars_t & vars) const {
+	return run_expression(*this, [&](int name) {
+		auto iter = vars.find(names[name]);
+		if (iter == vars.end())
+			throw std::runtime_error("no such variable '" + std::string(names[name]) + "' in expression '" + std::string(text) + "'");
+		return iter->second;
+	});
+}
+
+// table(<expression of i>, <first>, <end>[, <step>]) are values of the expression for i from first up to end
+int parse_table(const char * str, parse_context & ctx, std::vector<int> & values) {
+	int i = 6;
+	expression_t expr;
+	i += parse_expression(str + i, ctx, expr, true);
+	int bounds[3] = { 0, 0, 1 };
+	int k = 0;
+	for (skip_space(str, i); str[i] == ',' && k < 3; k++, skip_space(str, i)) {
+		i++;
+		expression_t bound;
+		i += parse_expression(str + i, ctx, bound, true);
+		bounds[k] = constant_value(bound, "bound of a table");
+	}
+	if (k < 2 || str[i] != ')')
+		throw std::runtime_error("table(expression, first, end[, step]) expects 3 or 4 parameters");
+	i++;
+	for (int name = 0; name < expr.names_size; name++) {
+		if (expr.names[name] != "i")
+			throw std::runtime_error("only i can be used in a table expression, '" + std::string(expr.names[name]) + "' is a name");
+	}
+	int first = bounds[0], end = bounds[1], step = bounds[2];
+	if (step <= 0)
+		throw std::runtime_error("step of a table must be positive");
+	if (end < first)
+		throw std::runtime_error("table ends at " + std::to_string(end) + " before its first value " + std::to_string(first));
+	values.reserve(values.size() + (end - first + step - 1) / step);
+	for (long long at = first; at < end; at += step)
+		values.push_back(run_expression(expr, [&](int) { return int(at); }));
+	return i;
+}
 
+const std::string inst_list = "ASHVNTUCRLEGIOFXYZ" "P";
 const std::string tmp_name = "edsacc#tmp";
 const std::string add_name = "edsacc#add";
 const std::string sub_name = "edsacc#sub";
@@ -92,23 +330,14 @@ const std::string store_name = "edsacc#store";
 const std::string save_name = "edsacc#save";
 const std::string step_name = "STEP";
 
-void create_edsacc_vars(std::vector<std::unique_ptr<predicate_t>> & predicates);
-
-struct var_predicate final : public predicate_t {
-	std::string name;
-	var_predicate(const std::string & n) : name(n) {};
-	virtual int initialize(int inst_n, std::unordered_map<std::string, int> & vars) override;
-	virtual void resolve(const std::unordered_map<std::string, int> & vars) override;
-	virtual std::ostream & write_to(std::ostream & out) const override;
-};
-
-int parse_as_var(const char * str, std::vector<std::unique_ptr<predicate_t>> & predicates) {
+int parse_as_var(const char * str, parse_context & ctx) {
 	int i = 0;
 	if (str[0] == '$') {
 		i++;
 		skip_space(str, i);
 		int sz = min(find_word_end(str + i), find_char(str + i, '='));
-		predicates.push_back(std::make_unique<var_predicate>(std::string(str + i, sz)));
+		ctx.add<var_predicate>(std::string_view(str + i, sz));
+		ctx.declarations.emplace_back(std::string_view(str + i, sz), int(str + i - ctx.text));
 		return i + sz;
 	}
 	int offset = *str == ':';
@@ -118,18 +347,19 @@ int parse_as_var(const char * str, std::vector<std::unique_ptr<predicate_t>> & p
 	int j = i + sz + offset;
 	if (str[j] != ':')
 		throw std::runtime_error(std::string("unexpected symbol after variable name '") + str[j] + "'");
-	predicates.push_back(std::make_unique<var_predicate>(std::string(str + offset, sz)));
+	ctx.add<var_predicate>(std::string_view(str + offset, sz));
+	ctx.declarations.emplace_back(std::string_view(str + offset, sz), int(str + offset - ctx.text));
 	return j + 1;
 }
 
-int var_predicate::initialize(int inst_n, std::unordered_map<std::string, int> & vars) {
+int var_predicate::initialize(int inst_n, vars_t & vars) {
 	if (vars.find(name) != vars.end())
-		throw std::runtime_error("variable '" + name + "' already exists");
+		throw std::runtime_error("variable '" + std::string(name) + "' already exists");
 	vars[name] = inst_n;
 	return inst_n;
 }
 
-void var_predicate::resolve(const std::unordered_map<std::string, int> & vars) {}
+void var_predicate::resolve(const vars_t & vars) {}
 
 std::ostream & var_predicate::write_to(std::ostream & out) const {
 	if (arguments.debug)
@@ -137,130 +367,212 @@ std::ostream & var_predicate::write_to(std::ostream & out) const {
 	return out;
 }
 
-static int offset = 0;
-const std::string char_table = "PQWERTYUIOJ#SZK*.F@D!HNM&LXGABCV";
-
-struct command_predicate : public predicate_t {
-	char prefix;
-	std::variant<std::string, int> addr;
-	bool is_long;
-	char suffics;
-	int inst_address;
-	command_predicate(char pre, const std::variant<std::string, int> & a, char post, bool l) :
-		prefix(pre), addr(a), suffics(post), is_long(l) {}
-	virtual void resolve(const std::unordered_map<std::string, int> & vars) final override;
-	virtual std::ostream & write_to(std::ostream & out) const override;
-};
+int command_predicate::relocate(const vars_t & vars, int before) {
+	offset = before;
+	if (prefix != 'G' || (suffics != 'K' && suffics != 'Z'))
+		return before;
+	resolve(vars);
+	int after = address + inst_address;
+	if (suffics == 'Z')
+		after += inst_address;
+	return after;
+}
 
-void command_predicate::resolve(const std::unordered_map<std::string, int> & vars) {
-	if (std::holds_alternative<std::string>(addr)) {
-		const std::string & name = std::get<std::string>(addr);
-		auto iter = vars.find(name);
-		if (iter == vars.end())
-			throw std::runtime_error("no such variable '" + name + "'");
-		if (arguments.io == 2) {
-			int i = char_table.find_first_of(suffics, 17);
-			int a = iter->second;
-			if (suffics == 'F' || suffics == 'K') {
+void command_predicate::resolve(const vars_t & vars) {
+	if (target_io != 2 && dynamic_cast<const direct_predicate *>(this))
+		throw std::runtime_error(std::string("directive \"") + prefix + ' ' + suffics + "\" exists only in Initial Orders 2");
+	if (std::holds_alternative<int>(addr))
+		address = std::get<int>(addr);
+	else {
+		int a;
+		std::string_view source;
+		if (auto name = std::get_if<std::string_view>(&addr)) {
+			auto iter = vars.find(*name);
+			if (iter == vars.end())
+				throw std::runtime_error("no such variable '" + std::string(*name) + "'");
+			a = iter->second;
+			source = iter->first;
+		} else {
+			const expression_t & expr = std::get<expression_t>(addr);
+			a = expr.evaluate(vars);
+			source = expr.text;
+		}
+		if (target_io == 2) {
+			char suffix = target_suffix(suffics, 2);
+			if (suffix == 'F' || suffix == 'K') {
 				// step 5
-			} else if (suffics == '@' || suffics == 'Z') {
+			} else if (suffix == '@' || suffix == 'Z') {
 				// step 7
 				a += - offset;
 			} else
-				*err << "link time warning: can't link properly \"" << prefix << ' ' << iter->first << ' ' << suffics << "\" "
-				"suffix must be F, K, @ or Z";
-			if (a < 0)
-				throw std::runtime_error(std::string("link result address is lower than 0. "
-					"Did you reference to the variable that is out of the scope? Instruction: \"") +
-					prefix + ' ' + iter->first + ' ' + suffics + "\"");
-			addr = a;
-		} else
-			addr = iter->second;
-	}
-	if (prefix == 'G') {
-		if (suffics == 'K' || suffics == 'Z') {
-			offset = std::get<int>(addr) + inst_address;
+				*err << "link time warning: can't link properly \"" << prefix << ' ' << source << ' ' << suffics << "\" "
+				"suffix must be F, K, @ or Z" << std::endl;
 		}
-		if (suffics == 'Z')
-			offset += inst_address;
+		if (a < 0)
+			throw std::runtime_error(std::string("link result address is lower than 0. "
+				"Did you reference to the variable that is out of the scope? Instruction: \"") +
+				prefix + ' ' + std::string(source) + ' ' + suffics + "\"");
+		if (a >= store_size)
+			throw std::runtime_error("link result address " + std::to_string(a) + " is out of the store of " +
+				std::to_string(store_size) + " words. Instruction: \"" + prefix + ' ' + std::string(source) + ' ' + suffics + "\"");
+		address = a;
 	}
 }
 
+names_t command_predicate::references() const {
+	if (auto name = std::get_if<std::string_view>(&addr))
+		return { name, name + 1 };
+	if (auto expr = std::get_if<expression_t>(&addr))
+		return { expr->names, expr->names + expr->names_size };
+	return { nullptr, nullptr };
+}
+
 std::ostream & command_predicate::write_to(std::ostream & out) const {
-	int address = std::get<int>(addr);
 	out << prefix;
 	if (address)
 		out << address;
+	// Initial Orders 1 have no #, a long order has the L suffix
+	if (is_long && target_io == 1)
+		return out << 'L';
 	if (is_long)
 		out << '#';
-	return out << suffics;
+	return out << target_suffix(suffics, target_io);
 }
 
-struct inst_predicate final : public command_predicate {
-	inst_predicate(char pre, const std::variant<std::string, int> & a, char post, bool l) :
-		command_predicate(pre, a, post, l) {}
-	virtual int initialize(int inst_n, std::unordered_map<std::string, int> & vars) override;
-	virtual std::ostream & write_to(std::ostream & out) const override;
-};
+char target_suffix(char suffix, int io) {
+	if (io == arguments.io)
+		return suffix;
+	if (io == 2)
+		return suffix == 'S' ? 'F' : suffix == 'L' ? 'D' : suffix;
+	// addresses of @ orders are absolute in Initial Orders 1
+	return suffix == 'F' || suffix == '@' ? 'S' : suffix == 'D' ? 'L' : suffix;
+}
 
-struct direct_predicate final : public command_predicate {
-	direct_predicate(char pre, const std::variant<std::string, int> & a, char post, bool l) :
-		command_predicate(pre, a, post, l) {}
-	virtual int initialize(int inst_n, std::unordered_map<std::string, int> & vars) override;
-	virtual std::ostream & write_to(std::ostream & out) const override;
-};
+std::string target_text(std::string_view text, int io) {
+	std::string result(text);
+	for (size_t i = 0; i < result.size(); ) {
+		// order letter, address, # of a long word and the suffix
+		for (i++; i < result.size() && std::isdigit(result[i]); i++);
+		if (i < result.size() && result[i] == '#')
+			i++;
+		if (i < result.size()) {
+			result[i] = target_suffix(result[i], io);
+			i++;
+		}
+	}
+	return result;
+}
 
-struct const_predicate final : public predicate_t {
-	std::vector<std::string> inst;
-	int count;
-	int inst_address;
-	const_predicate(const std::vector<std::string> && i, int c) : inst(std::move(i)), count(c) {}
-	virtual int initialize(int inst_n, std::unordered_map<std::string, int> & vars) override;
-	virtual void resolve(const std::unordered_map<std::string, int> & vars) override;
-	virtual std::ostream & write_to(std::ostream & out) const override;
-};
+// one 17 bit word as an order of the tape, the lowest bit is the suffix
+void write_word(int word, std::string & inst, int io) {
+	inst += char_table[(word >> 12) & 0b11111];
+	inst += std::to_string((word >> 1) & ((1 << 11) - 1));
+	inst += word & 1 ? long_suffix(io) : short_suffix(io);
+}
+
+// a long word as the word at m with its lower 17 digits and the word at m+1 with the digits above them
+void write_long_word(long long value, std::string & inst, int io) {
+	write_word(int(value & 0x1ffff), inst, io);
+	write_word(int(value >> 17), inst, io);
+}
 
-int write_integer(int value, char suffix, std::string & inst) {
-	int first = value >> 17;
+int write_integer(int value, char suffix, std::string & inst, int io) {
 	bool is_long = suffix == 'l' || ((abs(value) >> 17) > 0 && suffix != 's');
-	int bitS = value & 1;
-	int bitL = first & 1;
-	first >>= 1;
-	value >>= 1;
-	if (arguments.io == 2) {
-		inst += (char_table[(value >> 11) & 0b11111] + std::to_string(value & ((1 << 11) - 1)) +
-			(bitS ? 'D' : 'F'));
-		if (is_long)
-			inst += (char_table[(first >> 11) & 0b11111] + std::to_string(first & ((1 << 11) - 1)) +
-				(bitL ? 'D' : 'F'));
-	} else {
-		inst += (char_table[(value >> 11) & 0b11111] + std::to_string(value & ((1 << 11) - 1)) +
-			(bitS ? 'L' : 'S'));
-		if (is_long)
-			inst += (char_table[(first >> 11) & 0b11111] + std::to_string(first & ((1 << 11) - 1)) +
-				(bitL ? 'L' : 'S'));
+	if (is_long)
+		write_long_word(value, inst, io);
+	else
+		write_word(value, inst, io);
+	return 1 + is_long;
+}
+
+// length of a decimal fraction literal like -0.125 at str, 0 if it is not one
+int fraction_length(const char * str) {
+	int i = str[0] == '-' || str[0] == '+';
+	for (; std::isdigit(str[i]); i++);
+	if (str[i] != '.' || !std::isdigit(str[i + 1]))
+		return 0;
+	for (i++; std::isdigit(str[i]); i++);
+	return i;
+}
+
+// doubles the decimal digits after the point and returns the digit that goes before the point
+int double_fraction(std::string & digits) {
+	int carry = 0;
+	for (auto d = digits.rbegin(); d != digits.rend(); ++d) {
+		int x = (*d - '0') * 2 + carry;
+		*d = char('0' + x % 10);
+		carry = x / 10;
 	}
+	return carry;
+}
+
+// EDSAC numbers are fractions -1 <= x < 1, a short word has 16 binary digits after the point and a long one,
+// split into two words like the long integers of write_integer, 33. The value is rounded to the nearest one,
+// halves are rounded away from zero, and a value that rounds up to 1 is the largest fraction below it.
+int write_fraction(std::string_view literal, char suffix, std::string & inst, int io) {
+	std::string text(literal);
+	bool negative = literal[0] == '-';
+	if (negative || literal[0] == '+')
+		literal.remove_prefix(1);
+	size_t point = literal.find('.');
+	std::string digits(literal.substr(point + 1));
+	bool one = literal.substr(0, point).find_first_not_of('0') != std::string_view::npos;
+	if (one && (literal.substr(0, point).find_first_not_of('0') + 1 != point || literal[point - 1] != '1'))
+		throw std::runtime_error("fraction " + text + " is out of the range -1 <= x < 1");
+	bool is_long = suffix == 'l';
+	int bits = is_long ? 33 : 16;
+	long long value = one;
+	for (int k = 0; k < bits; k++)
+		value = value * 2 + double_fraction(digits);
+	long long limit = 1LL << bits;
+	// digits that are left only round the value, they can't take it out of the range
+	bool rest = digits.find_first_not_of('0') != std::string::npos;
+	if (value > limit || (value == limit && (!negative || rest)))
+		throw std::runtime_error("fraction " + text + " is out of the range -1 <= x < 1");
+	value += double_fraction(digits);
+	if (!negative && value == limit)
+		value = limit - 1;
+	if (negative)
+		value = -value;
+	if (is_long)
+		write_long_word(value, inst, io);
+	else
+		write_word(int(value), inst, io);
 	return 1 + is_long;
 }
 
-int parse_as_inst(const char * str, std::vector<std::unique_ptr<predicate_t>> & predicates) {
+// a number or a name if the expression is just one of them
+std::variant<std::string_view, int, expression_t> address_of(const expression_t & expr) {
+	if (expr.size == 1 && expr.ops[0].kind == 'n')
+		return expr.ops[0].value;
+	if (expr.size == 1)
+		return expr.names[0];
+	return expr;
+}
+
+int parse_as_inst(const char * str, parse_context & ctx) {
 	int i = 0;
 	int index = -1;
 	bool push_it = true;
 	char prefix = str[i++];
-	std::variant<std::string, int> addr;
-	std::string name;
-	std::string indexer;
+	std::variant<std::string_view, int, expression_t> addr;
+	std::string_view name;
+	std::string_view indexer;
 	enum class type_t {
 		regular, index_name, index_static
 	} type = type_t::regular;
 	if (std::isspace(str[i]) || std::isdigit(str[i])) {
 		skip_space(str, i);
-		if (std::isdigit(str[i])) {
-			// regular instruction
-			int value;
-			i += read_int(str + i, value);
-			addr = value;
+		std::string_view word(str + i, find_word_end(str + i));
+		if (std::isdigit(str[i]) || (word.find('[') == std::string_view::npos && word.find_first_of("+-*/<>(") != std::string_view::npos)) {
+			// regular instruction, the address is folded into a number if it has no names
+			expression_t expr;
+			i += parse_expression(str + i, ctx, expr);
+			addr = address_of(expr);
+			const int * value = std::get_if<int>(&addr);
+			if (value && (*value < 0 || *value >= store_size))
+				throw std::runtime_error("address " + std::to_string(*value) + " is out of the store, it must be from 0 to " +
+					std::to_string(store_size - 1));
 		} else {
 			// instruction with variable
 			int sz = find_word_end(str + i);
@@ -273,12 +585,14 @@ int parse_as_inst(const char * str, std::vector<std::unique_ptr<predicate_t>> &
 			}
 			if (c == '[') {
 				// indexing a variable
-				name = std::string(str + i, j);
+				name = std::string_view(str + i, j);
 				i += 1 + j;
 				skip_space(str, i);
-				if (std::isdigit(str[i])) {
+				if (std::isdigit(str[i]) || str[i] == '(' || str[i] == '-') {
 					// static offset
-					i += read_int(str + i, index);
+					expression_t expr;
+					i += parse_expression(str + i, ctx, expr, true);
+					index = constant_value(expr, "array index");
 					if (str[i] != ']' && !std::isspace(str[i]))
 						throw std::runtime_error(std::string("unexpected character in array index '") + str[i] + "'");
 					skip_space(str, i);
@@ -293,21 +607,23 @@ int parse_as_inst(const char * str, std::vector<std::unique_ptr<predicate_t>> &
 				} else {
 					// named variable index
 					j = min(find_char(str + i, ']'), find_word_end(str + i));
-					indexer = std::string(str + i, j);
+					indexer = std::string_view(str + i, j);
+					if (indexer.find_first_of("+-*/<>(") != std::string_view::npos)
+						throw std::runtime_error("array index must be a variable name or a constant expression");
 					i += j;
 					skip_space(str, i);
 					if (str[i] != ']')
 						throw std::runtime_error("closing ']' expected in array index");
 					i++;
 					// insert index code block
-					char s = arguments.io == 2 ? 'F' : 'S';
+					char s = short_suffix(ctx.state.io);
 					if (prefix == 'A' || prefix == 'S' || prefix == 'T' || prefix == 'U')
 						type = type_t::index_name;
 					else
 						throw std::runtime_error(std::string("operation '") + prefix + "' does not support indexing");
 				}
 			} else {
-				addr = std::string(str + i, sz);
+				addr = std::string_view(str + i, sz);
 				i += sz;
 			}
 		}
@@ -315,57 +631,82 @@ int parse_as_inst(const char * str, std::vector<std::unique_ptr<predicate_t>> &
 	} else
 		addr = 0;
 	bool is_long = false;
-	if (arguments.io == 2 && str[i] == '#') {
+	if (ctx.state.io == 2 && str[i] == '#') {
 		is_long = true;
 		i++;
 	}
 	char suffics = str[i++];
 	switch (type) {
 	case type_t::regular: {
-		if (arguments.io == 2 && (suffics == 'K' || suffics == 'Z'))
-			predicates.push_back(std::make_unique<direct_predicate>(prefix, addr, suffics, is_long));
+		if (ctx.state.io == 2 && (suffics == 'K' || suffics == 'Z'))
+			ctx.add<direct_predicate>(prefix, addr, suffics, is_long);
 		else
-			predicates.push_back(std::make_unique<inst_predicate>(prefix, addr, suffics, is_long));
+			ctx.add<inst_predicate>(prefix, addr, suffics, is_long);
 		break;
 	}
 	case type_t::index_static:
 	case type_t::index_name: {
-		char s = arguments.io == 2 ? 'F' : 'S';
+		char s = short_suffix(ctx.state.io);
 		// get or set value;
 		if (is_long)
-			*err << "warning: long variables not supported in array indexing predicate" << std::endl;
-		predicates.push_back(std::make_unique<inst_predicate>('T', tmp_name, s, false));
-		predicates.push_back(std::make_unique<inst_predicate>('A', name, suffics, false));
-		if (type == type_t::index_static)
-			indexer = name + "#index#" + std::to_string(predicates.size());
-		predicates.push_back(std::make_unique<inst_predicate>('A', indexer, suffics, false));
-		predicates.push_back(std::make_unique<inst_predicate>('L', 0, arguments.io == 2 ? 'D' : 'L', false));
+			ctx.warnings.emplace_back(-1, "long variables not supported in array indexing predicate");
+		ctx.add<inst_predicate>('T', tmp_name, s, false);
+		if (arguments.bounds_check && type == type_t::index_static) {
+			// the size of the array is known when the program is linked
+			if (index < 0)
+				throw std::runtime_error("array index " + std::to_string(index) + " is out of bounds");
+			ctx.add<var_predicate>(ctx.label({ index_prefix, std::to_string(index + 1), "#" }, str));
+		}
+		if (arguments.bounds_check && type == type_t::index_name) {
+			// 0 <= i < size or the program stops, the check is removed later if i is known to fit
+			ctx.add<var_predicate>(ctx.label({ check_prefix }, str));
+			for (auto layer = ctx.stack.rbegin(); layer != ctx.stack.rend(); ++layer) {
+				if (layer->type == layer_t::for_loop && layer->var == indexer) {
+					layer->checks.push_back(ctx.predicates.size() - 1);
+					break;
+				}
+			}
+			std::string_view size = ctx.join({ name, "#size" });
+			std::string_view stop = ctx.join({ name, "#stop" });
+			ctx.add<inst_predicate>('A', indexer, suffics, false);
+			ctx.add<inst_predicate>('S', size, suffics, false);
+			ctx.add<inst_predicate>('E', stop, suffics, false);
+			ctx.add<inst_predicate>('A', size, suffics, false);
+			ctx.add<inst_predicate>('G', stop, suffics, false);
+			ctx.add<inst_predicate>('A', name, suffics, false);
+		} else {
+			ctx.add<inst_predicate>('A', name, suffics, false);
+			if (type == type_t::index_static)
+				indexer = ctx.label({ name, "#index#" }, str);
+			ctx.add<inst_predicate>('A', indexer, suffics, false);
+		}
+		ctx.add<inst_predicate>('L', 0, long_suffix(ctx.state.io), false);
 		switch (prefix) {
-			case 'A': predicates.push_back(std::make_unique<inst_predicate>('A', add_name, s, false)); break;
-			case 'S': predicates.push_back(std::make_unique<inst_predicate>('A', sub_name, s, false)); break;
-			case 'T': predicates.push_back(std::make_unique<inst_predicate>('A', store_name, s, false)); break;
-			case 'U': predicates.push_back(std::make_unique<inst_predicate>('A', save_name, s, false)); break;
-		}
-		std::string var = name + "#mod#" + std::to_string(predicates.size());
-		predicates.push_back(std::make_unique<inst_predicate>('T', var, suffics, false));
-		predicates.push_back(std::make_unique<inst_predicate>('A', tmp_name, s, false));
+			case 'A': ctx.add<inst_predicate>('A', add_name, s, false); break;
+			case 'S': ctx.add<inst_predicate>('A', sub_name, s, false); break;
+			case 'T': ctx.add<inst_predicate>('A', store_name, s, false); break;
+			case 'U': ctx.add<inst_predicate>('A', save_name, s, false); break;
+		}
+		std::string_view var = ctx.label({ name, "#mod#" }, str);
+		ctx.add<inst_predicate>('T', var, suffics, false);
+		ctx.add<inst_predicate>('A', tmp_name, s, false);
 		if (type == type_t::index_static) {
-			predicates.push_back(std::make_unique<inst_predicate>('E', var, suffics, false));
-			predicates.push_back(std::make_unique<inst_predicate>('G', var, suffics, false));
-			predicates.push_back(std::make_unique<var_predicate>(indexer));
+			ctx.add<inst_predicate>('E', var, suffics, false);
+			ctx.add<inst_predicate>('G', var, suffics, false);
+			ctx.add<var_predicate>(indexer);
 			std::string value;
-			write_integer(index, 's', value);
-			predicates.push_back(std::make_unique<const_predicate>(std::vector<std::string>{ value }, 1));
+			write_integer(index, 's', value, ctx.state.io);
+			ctx.add<const_predicate>(ctx.words({ value }), 1);
 		}
-		predicates.push_back(std::make_unique<var_predicate>(var));
-		predicates.push_back(std::make_unique<inst_predicate>('P', 0, s, false));
+		ctx.add<var_predicate>(var);
+		ctx.add<inst_predicate>('P', 0, s, false);
 		break;
 	}
 	}
 	return i;
 }
 
-int inst_predicate::initialize(int inst_n, std::unordered_map<std::string, int> & vars) {
+int inst_predicate::initialize(int inst_n, vars_t & vars) {
 	inst_address = inst_n;
 	return inst_n + 1;
 }
@@ -379,7 +720,17 @@ std::ostream & inst_predicate::write_to(std::ostream & out) const {
 	return out;
 }
 
-int direct_predicate::initialize(int inst_n, std::unordered_map<std::string, int> & vars) {
+void inst_predicate::assemble(store_image & image) const {
+	char suffix = target_suffix(suffics, target_io);
+	if (target_io == 2) {
+		// Initial Orders 2 add the relocation offset to @ and Z orders and 1 to D ones
+		bool relative = suffix == '@' || suffix == 'Z';
+		image.put(inst_address, make_word(prefix, address + (relative ? offset : 0), is_long || suffix == 'D'));
+	} else
+		image.put(inst_address, make_word(prefix, address, is_long || suffix == 'L'));
+}
+
+int direct_predicate::initialize(int inst_n, vars_t & vars) {
 	inst_address = inst_n;
 	return inst_n;
 }
@@ -393,52 +744,68 @@ std::ostream & direct_predicate::write_to(std::ostream & out) const {
 	return out;
 }
 
-struct ptr_predicate final : public predicate_t {
-	std::string var;
-	int inst_address;
-	int first_element;
-	ptr_predicate(const std::string & name) : var(name) {}
-	virtual int initialize(int inst_n, std::unordered_map<std::string, int> & vars) override {
-		vars[var] = inst_n;
-		inst_address = inst_n;
-		return inst_n + 1;
-	}
-	virtual void resolve(const std::unordered_map<std::string, int> & vars) override {
-		auto iter = vars.find(var);
-		if (iter == vars.end())
-			throw std::runtime_error("FATAL: KTLO IS A BAG?!");
-		first_element = iter->second + 1;
-	}
-	virtual std::ostream & write_to(std::ostream & out) const override {
-		if (arguments.debug)
-			out << "    [^ " << inst_address << "]";
-		std::string inst;
-		write_integer(first_element, 's', inst);
-		out << inst;
-		if (arguments.debug)
-			out << std::endl;
-		return out;
-	}
-};
+void direct_predicate::assemble(store_image & image) const {
+	// E m K of Initial Orders 2 is the only one that is not about loading
+	if (prefix == 'E' && (suffics == 'K' || suffics == 'Z'))
+		image.set_entry(address + (suffics == 'Z' ? offset : 0));
+}
+
+int ptr_predicate::initialize(int inst_n, vars_t & vars) {
+	vars[var] = inst_n;
+	inst_address = inst_n;
+	return inst_n + 1;
+}
+
+void ptr_predicate::resolve(const vars_t & vars) {
+	auto iter = vars.find(var);
+	if (iter == vars.end())
+		throw std::runtime_error("FATAL: KTLO IS A BAG?!");
+	first_element = iter->second + 1;
+}
 
-int parse_as_const(const char * str,  std::vector<std::unique_ptr<predicate_t>> & predicates) {
+std::ostream & ptr_predicate::write_to(std::ostream & out) const {
+	if (arguments.debug)
+		out << "    [^ " << inst_address << "]";
+	std::string inst;
+	write_integer(first_element, 's', inst, target_io);
+	out << inst;
+	if (arguments.debug)
+		out << std::endl;
+	return out;
+}
+
+void ptr_predicate::assemble(store_image & image) const {
+	image.put(inst_address, first_element & 0x1ffff);
+}
+
+int parse_as_const(const char * str, parse_context & ctx) {
+	predicates_t & predicates = ctx.predicates;
 	int i = 0;
 	int count = 0;
-	std::vector<std::string> inst;
+	int zeros = 0;
+	// words in inst, count has the words of expression predicates before them too
+	int written = 0;
+	bool split = false;
+	// name of the array, if it is one
+	std::string_view array;
+	std::pmr::vector<std::pmr::string> inst(ctx.memory);
 	if (str[i] == '=') {
 		i++;
 		skip_space(str, i);
-		if (str[i] == '[' || str[i] == '{') {
+		if (str[i] == '[' || str[i] == '{' || !std::strncmp(str + i, "table(", 6)) {
 			const var_predicate & var = dynamic_cast<const var_predicate &>(*predicates.back());
+			array = var.name;
 			// add array ptr first
-			predicates.push_back(std::make_unique<ptr_predicate>(var.name));
+			ctx.add<ptr_predicate>(var.name);
 			// array literal
 			int allocate = -1;
 			if (str[i] == '[') {
 				int j = i + find_last_bracket(str + i);
 				i++;
 				skip_space(str, i);
-				i += read_int(str + i, allocate);
+				expression_t expr;
+				i += parse_expression(str + i, ctx, expr, true);
+				allocate = constant_value(expr, "array size");
 				if (allocate < 0)
 					throw std::runtime_error("can't allocate negative " + std::to_string(allocate) + " number of short elements");
 				skip_space(str, i);
@@ -447,58 +814,97 @@ int parse_as_const(const char * str,  std::vector<std::unique_ptr<predicate_t>>
 				i++;
 				skip_space(str, i);
 			}
+			// one value, or values of a table, with an optional suffix
+			auto element = [&]() {
+				std::vector<int> values;
+				expression_t expr;
+				std::string_view fraction(str + i, fraction_length(str + i));
+				if (!std::strncmp(str + i, "table(", 6))
+					i += parse_table(str + i, ctx, values);
+				else if (fraction.size())
+					i += fraction.size();
+				else
+					i += parse_expression(str + i, ctx, expr, true);
+				char c = str[i];
+				if (c != 's' && c != 'l' && c != ',' && c != '}' && !std::isspace(c) && c != 0)
+					throw std::runtime_error(std::string("unexpected character in array initialization block '") + c + "'");
+				if (expr.names_size > 0) {
+					// words before it are one constant, the value of the expression is another one
+					count += c == 'l' ? 2 : 1;
+					if (!inst.empty())
+						ctx.add<const_predicate>(std::exchange(inst, std::pmr::vector<std::pmr::string>(ctx.memory)), written);
+					ctx.add<expr_predicate>(expr, c == 'l' ? 'l' : 's');
+					written = 0;
+					split = true;
+				} else if (fraction.size()) {
+					std::string next;
+					int n = write_fraction(fraction, c, next, ctx.state.io);
+					count += n;
+					written += n;
+					inst.emplace_back(next);
+				} else if (expr.size > 0)
+					values.push_back(expr.ops[0].value);
+				for (int value : values) {
+					std::string next;
+					int n = write_integer(value, c, next, ctx.state.io);
+					count += n;
+					written += n;
+					inst.emplace_back(next);
+				}
+				if (c == 's' || c == 'l') i++;
+			};
 			if (str[i] == '{') {
 				int j = i + find_last_bracket(str + i);
 				for (i++, skip_space(str, i); i < j;) {
-					int value;
-					i += read_int(str + i, value);
-					char c = str[i];
-					if (c != 's' && c != 'l' && c != ',' && c != '}' && !std::isspace(c))
-						throw std::runtime_error(std::string("unexpected character in array initialization block '") + c + "'");
-					std::string next;
-					count += write_integer(value, c, next);
-					inst.push_back(next);
-					if (c == 's' || c == 'l') i++;
+					element();
 					skip_space(str, i);
 					if (i == j)
 						break;
 					if (str[i] != ',')
-						throw std::runtime_error("only integer literals supported in array initialization block");
+						throw std::runtime_error("',' expected between values in array initialization block");
 					i++;
 					skip_space(str, i);
 				}
 				i++;
-			}
+			} else if (!std::strncmp(str + i, "table(", 6))
+				element();
 			if (allocate >= 0) {
-				int size = allocate - count;
-				if (size < 0)
+				zeros = allocate - count;
+				if (zeros < 0)
 					throw std::runtime_error("allocated number " + std::to_string(allocate) +
 						" lower than initializided " + std::to_string(count));
-				std::string zero = std::string("P") + ((arguments.io == 2) ? 'F' : 'S');
-				count += size;
-				while (size--)
-					inst.push_back(zero);
+				count += zeros;
 			}
 		} else {
-			// integer literal
-			int const_sz = find_word_end(str + i);
-			int j = i + const_sz;
-			int value;
-			i += read_int(str + i, value);
+			// integer literal or expression, an expression that starts with '(' may have spaces
+			bool spaces = str[i] == '(';
+			int j = i + find_word_end(str + i);
+			expression_t expr;
+			std::string_view fraction(str + i, fraction_length(str + i));
+			i += fraction.size() ? fraction.size() : parse_expression(str + i, ctx, expr, spaces);
+			if (spaces)
+				j = i + find_word_end(str + i);
 			char c = str[i];
 			if (i + !std::isspace(c) != j)
 				throw std::runtime_error(std::string("unexpected character in constant literal '") + c + "'");
-			if (c == 's' || c == 'l' || std::isspace(c)) {
-				std::string str_inst;
-				count += write_integer(value, c, str_inst);
-				inst.push_back(str_inst);
-			} else
+			if (c != 's' && c != 'l' && !std::isspace(c))
 				throw std::runtime_error("not implemented constant type");
 			i = j;
+			if (expr.names_size > 0) {
+				// the value is known when names get their addresses
+				ctx.add<expr_predicate>(expr, c == 'l' ? 'l' : 's');
+				return i;
+			}
+			std::string str_inst;
+			if (fraction.size())
+				written += write_fraction(fraction, c, str_inst, ctx.state.io);
+			else
+				written += write_integer(expr.ops[0].value, c, str_inst, ctx.state.io);
+			inst.emplace_back(str_inst);
 		}
 	} else if(!std::strncmp(str + i, "CONST(", 6)) {
 		i += 5;
-		count = 1;
+		written = 1;
 		int value;
 		int j = i + find_last_bracket(str + i);
 		i++;
@@ -512,20 +918,31 @@ int parse_as_const(const char * str,  std::vector<std::unique_ptr<predicate_t>>
 		skip_space(str, i);
 		if (i != j)
 			throw std::runtime_error("closing bracket expected");
-		inst.push_back(char_table[value >> 12] + std::to_string(value & ((1 << 12) - 1)) + c);
+		inst.emplace_back(char_table[value >> 12] + std::to_string(value & ((1 << 12) - 1)) + c);
 		i++;
 	} else
 		throw std::invalid_argument("FATAL OTHER BUGS!!! " + std::string(str + i, 10));
-	predicates.push_back(std::make_unique<const_predicate>(std::move(inst), count));
+	if (!split || !inst.empty() || zeros > 0)
+		ctx.add<const_predicate>(std::move(inst), written + zeros, zeros);
+	if (!array.empty() && arguments.bounds_check) {
+		// size for the checks of a[i] and the order they jump to if i is out of bounds
+		char s = short_suffix(ctx.state.io);
+		std::string size;
+		write_integer(count, 's', size, ctx.state.io);
+		ctx.add<var_predicate>(ctx.join({ array, "#size" }));
+		ctx.add<const_predicate>(ctx.words({ size }), 1);
+		ctx.add<var_predicate>(ctx.join({ array, "#stop" }));
+		ctx.add<inst_predicate>('Z', 0, s, false);
+	}
 	return i;
 }
 
-int const_predicate::initialize(int inst_n, std::unordered_map<std::string, int> & vars) {
+int const_predicate::initialize(int inst_n, vars_t & vars) {
 	inst_address = inst_n;
 	return inst_n + count;
 }
 
-void const_predicate::resolve(const std::unordered_map<std::string, int> & vars) {}
+void const_predicate::resolve(const vars_t & vars) {}
 
 std::ostream & const_predicate::write_to(std::ostream & out) const {
 	if (arguments.debug)
@@ -534,26 +951,64 @@ std::ostream & const_predicate::write_to(std::ostream & out) const {
 	for (const auto & i : inst) {
 		if (arguments.debug)
 			out << '[' << k++ << ']';
-		out << i;
+		out << target_text(i, target_io);
+	}
+	if (zeros > 0 && arguments.reserve_arrays && target_io == 2) {
+		// T m K moves the load address of Initial Orders 2 past the zeros
+		if (arguments.debug)
+			out << "[reserved " << zeros << ']';
+		out << 'T' << inst_address + count << 'K';
+	} else {
+		const char * zero = target_io == 2 ? "PF" : "PS";
+		for (int z = 0; z < zeros; z++) {
+			if (arguments.debug)
+				out << '[' << k++ << ']';
+			out << zero;
+		}
 	}
 	if (arguments.debug)
 		out << std::endl;
 	return out;
 }
 
-struct txt_predicate final : public predicate_t {
-	std::string text;
-	txt_predicate(const std::string & str) : text(str) {}
-	virtual int initialize(int inst_n, std::unordered_map<std::string, int> & vars) override;
-	virtual void resolve(const std::unordered_map<std::string, int> & vars) override;
-	virtual std::ostream & write_to(std::ostream & out) const override;
-};
+void const_predicate::assemble(store_image & image) const {
+	int address = inst_address;
+	// zeros are not a part of the image, words out of its segments are zero
+	for (const auto & i : inst)
+		address = image.put_text(address, target_text(i, target_io), target_io);
+}
+
+int expr_predicate::initialize(int inst_n, vars_t &) {
+	inst_address = inst_n;
+	return inst_n + (suffix == 'l' ? 2 : 1);
+}
 
-int txt_predicate::initialize(int inst_n, std::unordered_map<std::string, int> & vars) {
+void expr_predicate::resolve(const vars_t & vars) {
+	value = expr.evaluate(vars);
+}
+
+std::ostream & expr_predicate::write_to(std::ostream & out) const {
+	if (arguments.debug)
+		out << "    [$ " << inst_address << "] [" << expr.text << ']';
+	std::string inst;
+	write_integer(value, suffix, inst, target_io);
+	out << inst;
+	if (arguments.debug)
+		out << std::endl;
+	return out;
+}
+
+void expr_predicate::assemble(store_image & image) const {
+	std::string inst;
+	write_integer(value, suffix, inst, target_io);
+	image.put_text(inst_address, inst, target_io);
+}
+
+int txt_predicate::initialize(int inst_n, vars_t & vars) {
 	return inst_n;
 }
 
-void txt_predicate::resolve(const std::unordered_map<std::string, int> & vars) {}
+void txt_predicate::resolve(const vars_t & vars) {}
 
 std::ostream & txt_predicate::write_to(std::ostream & out) const {
 	return out << text;
@@ -565,7 +1020,7 @@ std::pair<int, int> count_lines(const char * str, int size) {
 		if (str[i] == '\r' && str[i + 1] == '\n') {
 			// skip
 		} else if (str[i] == '\r' || str[i] == '\n') {
-			chars = 0;
+			chars = -1;
 			lines++;
 		}
 	}
@@ -581,346 +1036,1093 @@ inline void next_line(const char * str, int & i) {
 	if (str[i] == '\n') i++;
 }
 
-void create_edsacc_vars(std::vector<std::unique_ptr<predicate_t>> & predicates) {
-	char s = (arguments.io == 2) ? 'F' : 'S';
-	if (is_tmp_not_created) {
-		predicates.push_back(std::make_unique<var_predicate>(tmp_name));
-		predicates.push_back(std::make_unique<inst_predicate>('P', 0, s, false));
-		predicates.push_back(std::make_unique<var_predicate>(add_name));
-		predicates.push_back(std::make_unique<inst_predicate>('A', 0, s, false));
-		predicates.push_back(std::make_unique<var_predicate>(sub_name));
-		predicates.push_back(std::make_unique<inst_predicate>('S', 0, s, false));
-		predicates.push_back(std::make_unique<var_predicate>(store_name));
-		predicates.push_back(std::make_unique<inst_predicate>('T', 0, s, false));
-		predicates.push_back(std::make_unique<var_predicate>(save_name));
-		predicates.push_back(std::make_unique<inst_predicate>('U', 0, s, false));
-		predicates.push_back(std::make_unique<var_predicate>(step_name));
-		predicates.push_back(std::make_unique<const_predicate>(std::vector<std::string>{
-			std::string("P") + ((arguments.io == 2) ? 'D' : 'L')
-		}, 1));
-		is_tmp_not_created = false;
+std::string_view concatenate(std::pmr::memory_resource * memory, const std::string_view * begin, const std::string_view * end) {
+	size_t size = 0;
+	for (auto part = begin; part != end; part++)
+		size += part->size();
+	char * result = static_cast<char *>(memory->allocate(size, 1));
+	char * out = result;
+	for (auto part = begin; part != end; part++)
+		out = std::copy(part->begin(), part->end(), out);
+	return std::string_view(result, size);
+}
+
+std::string_view parse_context::join(std::initializer_list<std::string_view> parts) const {
+	return concatenate(memory, parts.begin(), parts.end());
+}
+
+std::string_view parse_context::label(std::initializer_list<std::string_view> prefix, const char * at) const {
+	char number[24];
+	char * end = std::to_chars(number, number + sizeof(number), origin + (at - text)).ptr;
+	std::string_view parts[5];
+	auto last = std::copy(prefix.begin(), prefix.end(), parts);
+	*last++ = unit;
+	*last++ = std::string_view(number, end - number);
+	return concatenate(memory, parts, last);
+}
+
+std::pmr::vector<std::pmr::string> parse_context::words(std::initializer_list<std::string_view> list) const {
+	std::pmr::vector<std::pmr::string> result(memory);
+	result.reserve(list.size());
+	for (auto word : list)
+		result.emplace_back(word);
+	return result;
+}
+
+std::pair<int, int> parse_context::position(int i) const {
+	if (map)
+		return count_lines(source, map->source_offset(start + i));
+	auto pair = count_lines(text, i);
+	pair.first += line;
+	return pair;
+}
+
+void parse_context::write_warnings(std::ostream & err) const {
+	if (map)
+		edsac::write_warnings(err, source, *map, start, warnings);
+	else
+		edsac::write_warnings(err, text, line, warnings);
+}
+
+template <typename Position>
+void write_warnings(std::ostream & err, const std::vector<std::pair<int, std::string>> & warnings, Position position_of) {
+	for (auto & warning : warnings) {
+		if (warning.first < 0) {
+			err << "warning: " << warning.second << std::endl;
+		} else {
+			auto pos = position_of(warning.first);
+			err << "warning:" << pos.first << ':' << pos.second << ": " << warning.second << std::endl;
+		}
 	}
 }
 
-const std::string inst_list = "ASHVNTUCRLEGIOFXYZ" "P";
+void write_warnings(std::ostream & err, const char * text, int line, const std::vector<std::pair<int, std::string>> & warnings) {
+	write_warnings(err, warnings, [&](int at) {
+		auto pos = count_lines(text, at);
+		pos.first += line;
+		return pos;
+	});
+}
 
-enum class layer_t {
-	for_loop
-};
+void write_warnings(std::ostream & err, const char * source, const source_map & map, int start, const std::vector<std::pair<int, std::string>> & warnings) {
+	write_warnings(err, warnings, [&](int at) { return count_lines(source, map.source_offset(start + at)); });
+}
 
-int parser::parse(std::ostream & err) {
-	edsac::err = &err;
+void line_splitter::skip_to(const char * end) {
+	int n = std::strlen(end);
+	for (; i < size && std::strncmp(str + i, end, n); i++);
+	i = std::min(i + n, size);
+}
 
-	std::vector<std::unique_ptr<predicate_t>> predicates;
-	std::unordered_map<std::string, std::string> defines;
-	std::vector<std::tuple<layer_t, std::string, std::string>> stack;
+// the word begins with the letters and goes on with digits only
+bool is_number_after(const char * word, int n, int letters) {
+	if (n <= letters)
+		return false;
+	for (int k = letters; k < n; k++) {
+		if (!std::isdigit(word[k]))
+			return false;
+	}
+	return true;
+}
 
-	std::string text( (std::istreambuf_iterator<char>(input)), (std::istreambuf_iterator<char>()) );
-	const char * str = text.c_str();
-	int i, size;
-	try {
-		for (i = 0, size = text.size(), skip_space(str, i); i < size; skip_space(str, i)) {
-			int word_sz = find_word_end(str + i);
-			int j = i + word_sz;
-			
-			// analyze word ending
-			switch (str[j - 1]) {
-				case ':': {
-					// my variable type
-					i += parse_as_var(str + i, predicates);
-					continue;
-				}
-				default:
+int line_splitter::next() {
+	int depth = 0;
+	// words after the current one that are not statements: the address and the suffix of an order,
+	// the name of sub or call, "= value" of a constant; the head of a block goes up to its closing word
+	int operands = 0;
+	const char * closing = nullptr;
+	int parentheses = 0;
+	do {
+		// a word by word scan of the line that only knows comments, brackets, statements and blocks
+		bool directive = false;
+		while (i < size && str[i] != '\r' && str[i] != '\n') {
+			if (std::isspace(str[i])) {
+				i++;
+				continue;
+			}
+			int begin = i;
+			// the word goes on after a comment or brackets, but its parentheses are before them
+			int code = -1;
+			for (; i < size && !std::isspace(str[i]); i++) {
+				if (str[i] == '/' && str[i + 1] == '/') {
+					code = i;
+					for (; i < size && str[i] != '\r' && str[i] != '\n'; i++);
+					break;
+				} else if (str[i] == '/' && str[i + 1] == '*') {
+					code = i;
+					i += 2;
+					skip_to("*/");
+					break;
+				} else if (str[i] == '[') {
+					code = i;
+					skip_to("]");
 					break;
+				} else if (str[i] == '{') {
+					code = i;
+					skip_to("}");
+					break;
+				}
 			}
-
-			// analyze word beggining
-			switch (str[i]) {
-				case '/': {
-					// maybe comment section
-					if (str[i+1] == '/') {
-						// line comment
-						next_line(str, i);
-						continue;
-					} else if (str[i + 1] == '*') {
-						// multiline comment
-						for (i+=2; str[i - 1] != '*' || str[i] != '/'; i++) {
-							if (!str[i])
-								throw std::runtime_error("multiline C style comment not closed");
-						}
-						i++;
-						continue;
-					}
+			const char * word = str + begin;
+			int n = i - begin;
+			bool operand = directive || parentheses > 0 || closing || operands > 0;
+			for (int k = begin; k < (code < 0 ? i : code); k++)
+				parentheses += (str[k] == '(') - (str[k] == ')');
+			if (code == begin && word[0] == '/')
+				continue;
+			if (operand) {
+				if (closing && parentheses == 0 && std::string_view(word, n) == closing)
+					closing = nullptr;
+				else if (operands > 0 && parentheses == 0) {
+					operands--;
+					// "=5" of a constant, "5F" of an order with its suffix
+					if ((word[0] == '=' && n > 1) || (std::isdigit(word[0]) && (std::isalpha(word[n - 1]) || word[n - 1] == '@')))
+						operands = 0;
 				}
-				case '[': {
-					// edsac comment section
-					for (; str[i] != ']'; i++){
+				continue;
+			}
+			std::string_view statement(word, n);
+			if (statement == "for" || statement == "while")
+				closing = "do";
+			else if (statement == "if")
+				closing = "then";
+			if (statement == "for" || statement == "if" || statement == "while" || statement == "sub")
+				depth++;
+			else if ((statement == "end" || statement == "endsub") && depth > 0)
+				depth--;
+			if (statement == "sub" || statement == "call")
+				operands = 1;
+			else if (word[0] == '~')
+				directive = true;
+			else if (word[0] == '$' && word[n - 1] != ':')
+				operands = statement.find('=') == std::string_view::npos ? 2 : word[n - 1] == '=';
+			else if (word[n - 1] != ':' && inst_list.find(word[0]) != std::string::npos && statement.substr(0, 6) != "CONST(")
+				// A, A5 and A 5 F are followed by the address, the suffix or both
+				operands = n == 1 ? 2 : is_number_after(word, n, 1);
+		}
+		if (i < size && str[i] == '\r') i++;
+		if (i < size && str[i] == '\n') i++;
+	} while (depth > 0 && i < size);
+	return i;
+}
+
+void create_edsacc_vars(parse_context & ctx) {
+	char s = short_suffix(ctx.state.io);
+	if (!ctx.state.special_vars) {
+		ctx.add<var_predicate>(tmp_name);
+		ctx.add<inst_predicate>('P', 0, s, false);
+		ctx.add<var_predicate>(add_name);
+		ctx.add<inst_predicate>('A', 0, s, false);
+		ctx.add<var_predicate>(sub_name);
+		ctx.add<inst_predicate>('S', 0, s, false);
+		ctx.add<var_predicate>(store_name);
+		ctx.add<inst_predicate>('T', 0, s, false);
+		ctx.add<var_predicate>(save_name);
+		ctx.add<inst_predicate>('U', 0, s, false);
+		ctx.add<var_predicate>(step_name);
+		ctx.add<const_predicate>(ctx.words({ ctx.state.io == 2 ? "PD" : "PL" }), 1);
+		ctx.state.special_vars = true;
+	}
+}
+
+bool is_special_vars(const predicate_t & p) {
+	auto var = dynamic_cast<const var_predicate *>(&p);
+	return var && var->name.data() == tmp_name.data();
+}
+
+// "<left> <relation> <right>" of if and while, the operands are names, 0, or acc on the left compared with 0 by < or >=
+int parse_condition(const char * str, condition_t & cond, acc_t & acc) {
+	int i = 0;
+	auto operand = [&]() {
+		skip_space(str, i);
+		int begin = i;
+		for (; str[i] && !std::isspace(str[i]) && str[i] != '<' && str[i] != '>' && str[i] != '='; i++);
+		std::string_view word(str + begin, i - begin);
+		if (word.empty())
+			throw std::runtime_error("operand of a condition expected");
+		if (word != "0" && word != "acc" && !std::isalpha(word[0]) && word[0] != '_')
+			throw std::runtime_error("only names, 0 and acc can be compared in a condition, '" + std::string(word) + "' is not one of them");
+		return word;
+	};
+	std::string_view left = operand();
+	skip_space(str, i);
+	if (str[i] != '<' && str[i] != '>')
+		throw std::runtime_error("relation <, <=, > or >= expected in a condition");
+	std::string_view relation(str + i, str[i + 1] == '=' ? 2 : 1);
+	i += relation.size();
+	std::string_view right = operand();
+	if (right == "acc")
+		throw std::runtime_error("acc can be only on the left of a condition");
+	// < and > are tests for a negative difference, <= and >= for a not negative one
+	cond.negative = relation.size() == 1;
+	if (left == "acc") {
+		if (right != "0" || (relation != "<" && relation != ">="))
+			throw std::runtime_error("acc can be only compared with 0 by < or >=");
+		acc = acc_t::kept;
+		return i;
+	}
+	// l < r is l - r < 0, l >= r is l - r >= 0, l > r is r - l < 0 and l <= r is r - l >= 0
+	if (relation == "<" || relation == ">=") {
+		cond.add = left;
+		cond.sub = right;
+	} else {
+		cond.add = right;
+		cond.sub = left;
+	}
+	if (cond.add == "0")
+		cond.add = {};
+	if (cond.sub == "0")
+		cond.sub = {};
+	if (cond.add.empty() && cond.sub.empty())
+		throw std::runtime_error("condition compares 0 with 0");
+	acc = acc_t::saved;
+	return i;
+}
+
+layer & innermost_loop(std::vector<layer> & stack) {
+	for (auto iter = stack.rbegin(); iter != stack.rend(); ++iter) {
+		if (iter->type == layer_t::for_loop || iter->type == layer_t::while_loop)
+			return *iter;
+	}
+	throw std::runtime_error("no loop to apply operator to");
+}
+
+// accumulator gets the difference of the condition, the order jumps to target if the condition is as expected
+void add_test(parse_context & ctx, const condition_t & cond, bool expected, std::string_view target, char s) {
+	if (!cond.add.empty())
+		ctx.add<inst_predicate>('A', cond.add, s, false);
+	if (!cond.sub.empty())
+		ctx.add<inst_predicate>('S', cond.sub, s, false);
+	// E jumps if the accumulator is not negative and G if it is negative
+	ctx.add<inst_predicate>(cond.negative == expected ? 'G' : 'E', target, s, false);
+}
+
+void add_restore(parse_context & ctx, acc_t acc, char s) {
+	if (acc == acc_t::kept)
+		return;
+	ctx.add<inst_predicate>('T', "LAST_INSTRUCTION", s, false);
+	if (acc == acc_t::saved)
+		ctx.add<inst_predicate>('A', tmp_name, s, false);
+}
+
+// Unconditional jump. Jumps of the current block to the generated labels right before it
+// go straight to the target, so they do not jump to a jump.
+void add_jump(parse_context & ctx, std::string_view target, char s) {
+	predicates_t & predicates = ctx.predicates;
+	size_t begin = ctx.stack.empty() ? predicates.size() : ctx.stack.back().begin;
+	size_t labels = predicates.size();
+	for (; labels > begin; labels--) {
+		auto var = dynamic_cast<const var_predicate *>(predicates[labels - 1].get());
+		if (!var || var->name.find('#') == std::string_view::npos)
+			break;
+	}
+	for (size_t k = begin; k < labels && labels < predicates.size(); k++) {
+		auto jump = dynamic_cast<inst_predicate *>(predicates[k].get());
+		if (!jump || (jump->prefix != 'E' && jump->prefix != 'G') || jump->suffics != s)
+			continue;
+		auto name = std::get_if<std::string_view>(&jump->addr);
+		if (!name)
+			continue;
+		for (size_t l = labels; l < predicates.size(); l++) {
+			if (static_cast<const var_predicate &>(*predicates[l]).name == *name) {
+				jump->addr = target;
+				break;
+			}
+		}
+	}
+	ctx.add<inst_predicate>('E', target, s, false);
+	ctx.add<inst_predicate>('G', target, s, false);
+}
+
+// the accumulator is clear if the last order stored it and there is no label after it
+bool is_acc_clear(const parse_context & ctx) {
+	if (ctx.predicates.empty())
+		return false;
+	auto inst = dynamic_cast<const inst_predicate *>(ctx.predicates.back().get());
+	return inst && inst->prefix == 'T';
+}
+
+// The body of the for loop can't change its variable: it does not store to it, does not call subroutines
+// and has no labels of the source but the ones of data, so there is no way into it but the head of the loop.
+bool keeps_variable(const parse_context & ctx, const layer & loop) {
+	const predicates_t & predicates = ctx.predicates;
+	for (size_t k = loop.body; k < predicates.size(); k++) {
+		const predicate_t * p = predicates[k].get();
+		if (auto var = dynamic_cast<const var_predicate *>(p)) {
+			bool data = k + 1 < predicates.size() && dynamic_cast<const const_predicate *>(predicates[k + 1].get());
+			if ((var->name.find('#') == std::string_view::npos && !data) || var->name.substr(0, call_prefix.size()) == call_prefix)
+				return false;
+			continue;
+		}
+		// T, U and I orders write to their address
+		auto command = dynamic_cast<const command_predicate *>(p);
+		if (!command || (command->prefix != 'T' && command->prefix != 'U' && command->prefix != 'I'))
+			continue;
+		names_t names = command->references();
+		if (std::find(names.first, names.second, loop.var) != names.second)
+			return false;
+	}
+	return true;
+}
+
+// name of a sub or of a called sub
+std::string_view read_name(const char * str, const char * error) {
+	int sz = find_word_end(str);
+	if (sz == 0 || (!std::isalpha(str[0]) && str[0] != '_'))
+		throw std::runtime_error(error);
+	return std::string_view(str, sz);
+}
+
+void parse_source(int & i, int size, parse_context & ctx) {
+	const char * str = ctx.text;
+	predicates_t & predicates = ctx.predicates;
+	auto & stack = ctx.stack;
+	for (skip_space(str, i); i < size; skip_space(str, i)) {
+		int word_sz = find_word_end(str + i);
+		int j = i + word_sz;
+		
+		// analyze word ending
+		switch (str[j - 1]) {
+			case ':': {
+				// my variable type
+				i += parse_as_var(str + i, ctx);
+				continue;
+			}
+			default:
+				break;
+		}
+
+		// analyze word beggining
+		switch (str[i]) {
+			case '/': {
+				// maybe comment section
+				if (str[i+1] == '/') {
+					// line comment
+					next_line(str, i);
+					continue;
+				} else if (str[i + 1] == '*') {
+					// multiline comment
+					for (i+=2; str[i - 1] != '*' || str[i] != '/'; i++) {
 						if (!str[i])
-							throw std::runtime_error("multiline edsak comment not closed");
+							throw std::runtime_error("multiline C style comment not closed");
 					}
 					i++;
 					continue;
 				}
-				case ':': {
-					// their variable type
-					i += parse_as_var(str + i, predicates);
-					continue;
+			}
+			case '[': {
+				// edsac comment section
+				for (; str[i] != ']'; i++){
+					if (!str[i])
+						throw std::runtime_error("multiline edsak comment not closed");
 				}
-				case '$': {
-					// my variable type
-					i += parse_as_var(str + i, predicates);
+				i++;
+				continue;
+			}
+			case ':': {
+				// their variable type
+				i += parse_as_var(str + i, ctx);
+				continue;
+			}
+			case '$': {
+				// my variable type
+				i += parse_as_var(str + i, ctx);
+				skip_space(str, i);
+				i += parse_as_const(str + i, ctx);
+				continue;
+			}
+			case 'f': {
+				// maybe for
+				if (!std::strncmp(str + i, "for", 3) && std::isspace(str[i + 3])) {
+					const char * at = str + i;
+					i += 3;
 					skip_space(str, i);
-					i += parse_as_const(str + i, predicates);
-					continue;
-				}
-				case 'f': {
-					// maybe for
-					if (!std::strncmp(str + i, "for", 3) && std::isspace(str[i + 3])) {
-						i += 3;
-						skip_space(str, i);
-						char s = arguments.io == 2 ? 'F' : 'S';
-						bool create_var = str[i] == '$';
-						if (create_var) i++;
-						int sz = find_word_end(str + i);
-						for (int k = 0; k < sz; k++) {
-							char c = str[i + k];
-							if (c == ',' || c == '=') {
-								sz = k;
-								break;
-							}
-						}
-						if (sz == 0)
-							throw std::runtime_error("new variable name is empty");
-						std::string var = std::string(str + i, sz);
-						i += sz;
-						if (create_var) {
-							//create new var
-							std::string point = "for#new_var#" + std::to_string(predicates.size());
-							predicates.push_back(std::make_unique<inst_predicate>('E', point, s, false));
-							predicates.push_back(std::make_unique<inst_predicate>('G', point, s, false));
-							predicates.push_back(std::make_unique<var_predicate>(var));
-							predicates.push_back(std::make_unique<const_predicate>(std::vector<std::string> { std::string("P") + s }, 1 ));
-							predicates.push_back(std::make_unique<var_predicate>(point));
-						}
-						skip_space(str, i);
-						if (create_var && str[i] != '=')
-							throw std::runtime_error("new var must be initialized");
-						if (str[i] == '=') {
-							i++;
-							skip_space(str, i);
-							int value;
-							i += read_int(str + i, value);
-							bool bit = value & 1;
-							value >>= 1;
-							std::string inst;
-							write_integer(value, 's', inst);
-							if (!std::isspace(str[i]) && str[i] != ',')
-								throw std::runtime_error("unexpected symbol in for loop initialisation");
-							// create const
-							std::string point = "for#init_var#" + std::to_string(predicates.size());
-							predicates.push_back(std::make_unique<inst_predicate>('E', point, s, false));
-							predicates.push_back(std::make_unique<inst_predicate>('G', point, s, false));
-							std::string const_val = "for#const#" + std::to_string(predicates.size());
-							predicates.push_back(std::make_unique<var_predicate>(const_val));
-							predicates.push_back(std::make_unique<const_predicate>(std::vector<std::string>{ inst }, 1));
-							predicates.push_back(std::make_unique<var_predicate>(point));
-							// initialize with const
-							predicates.push_back(std::make_unique<inst_predicate>('T', tmp_name, s, false));
-							predicates.push_back(std::make_unique<inst_predicate>('A', const_val, s, false));
-							predicates.push_back(std::make_unique<inst_predicate>('T', var, s, false));
-							predicates.push_back(std::make_unique<inst_predicate>('A', tmp_name, s, false));
-							skip_space(str, i);
+					char s = short_suffix(ctx.state.io);
+					bool create_var = str[i] == '$';
+					if (create_var) i++;
+					int sz = find_word_end(str + i);
+					for (int k = 0; k < sz; k++) {
+						char c = str[i + k];
+						if (c == ',' || c == '=') {
+							sz = k;
+							break;
 						}
-						if (str[i] != ',')
-							throw std::runtime_error("coma expected after loop variable");
+					}
+					if (sz == 0)
+						throw std::runtime_error("new variable name is empty");
+					std::string_view var(str + i, sz);
+					i += sz;
+					layer block{ layer_t::for_loop, {}, var };
+					if (create_var) {
+						//create new var
+						std::string_view point = ctx.label({ "for#new_var#" }, at);
+						ctx.add<inst_predicate>('E', point, s, false);
+						ctx.add<inst_predicate>('G', point, s, false);
+						ctx.add<var_predicate>(var);
+						ctx.declarations.emplace_back(var, i - sz);
+						ctx.add<const_predicate>(ctx.words({ s == 'F' ? "PF" : "PS" }), 1);
+						ctx.add<var_predicate>(point);
+					}
+					skip_space(str, i);
+					if (create_var && str[i] != '=')
+						throw std::runtime_error("new var must be initialized");
+					if (str[i] == '=') {
 						i++;
 						skip_space(str, i);
-						if (std::isdigit(str[i]))
-							throw std::runtime_error("not implemented yet");
-						sz = find_word_end(str + i);
-						std::string border = std::string(str + i, sz);
-						i += sz;
+						expression_t init;
+						i += parse_expression(str + i, ctx, init);
+						int value = constant_value(init, "initial value of a loop variable");
+						block.from = value;
+						std::string inst;
+						write_integer(value, 's', inst, ctx.state.io);
+						if (!std::isspace(str[i]) && str[i] != ',')
+							throw std::runtime_error("unexpected symbol in for loop initialisation");
+						// create const
+						std::string_view point = ctx.label({ "for#init_var#" }, at);
+						ctx.add<inst_predicate>('E', point, s, false);
+						ctx.add<inst_predicate>('G', point, s, false);
+						std::string_view const_val = ctx.label({ "for#const#" }, at);
+						ctx.add<var_predicate>(const_val);
+						ctx.add<const_predicate>(ctx.words({ inst }), 1);
+						ctx.add<var_predicate>(point);
+						// initialize with const
+						ctx.add<inst_predicate>('T', tmp_name, s, false);
+						ctx.add<inst_predicate>('A', const_val, s, false);
+						ctx.add<inst_predicate>('T', var, s, false);
+						ctx.add<inst_predicate>('A', tmp_name, s, false);
 						skip_space(str, i);
-						if (str[i] != 'd' || str[i + 1] != 'o')
-							throw std::runtime_error("'do' expected in loop definition");
-						i += 2;
-						std::string layer = "for#" + std::to_string(predicates.size());
-						// create a loop head
-						predicates.push_back(std::make_unique<inst_predicate>('T', tmp_name, s, false));
-						predicates.push_back(std::make_unique<var_predicate>(layer + "#redo"));
-						predicates.push_back(std::make_unique<inst_predicate>('A', var, s, false));
-						predicates.push_back(std::make_unique<inst_predicate>('S', border, s, false));
-						predicates.push_back(std::make_unique<inst_predicate>('E', layer + "#end", s, false));
-						predicates.push_back(std::make_unique<inst_predicate>('T', std::string("LAST_INSTRUCTION"), s, false));
-						predicates.push_back(std::make_unique<inst_predicate>('A', tmp_name, s, false));
-						stack.emplace_back(layer_t::for_loop, layer, var);
-						continue;
 					}
+					if (str[i] != ',')
+						throw std::runtime_error("coma expected after loop variable");
+					i++;
+					skip_space(str, i);
+					sz = find_word_end(str + i);
+					std::string_view border(str + i, sz);
+					if (std::isdigit(str[i]) || border.find_first_of("+-*/<>(") != std::string_view::npos) {
+						// the loop goes up to the value of the expression, it is kept in a cell before the loop
+						expression_t bound;
+						i += parse_expression(str + i, ctx, bound);
+						std::string_view point = ctx.label({ "for#bound_var#" }, at);
+						ctx.add<inst_predicate>('E', point, s, false);
+						ctx.add<inst_predicate>('G', point, s, false);
+						border = ctx.label({ "for#bound#" }, at);
+						ctx.add<var_predicate>(border);
+						if (bound.names_size > 0)
+							ctx.add<expr_predicate>(bound, 's');
+						else {
+							block.to = bound.ops[0].value;
+							std::string inst;
+							write_integer(block.to, 's', inst, ctx.state.io);
+							ctx.add<const_predicate>(ctx.words({ inst }), 1);
+						}
+						ctx.add<var_predicate>(point);
+					} else
+						// the loop goes up to the value of the variable
+						i += sz;
+					skip_space(str, i);
+					if (str[i] != 'd' || str[i + 1] != 'o')
+						throw std::runtime_error("'do' expected in loop definition");
+					i += 2;
+					block.name = ctx.label({ "for#" }, at);
+					// create a loop head
+					ctx.add<inst_predicate>('T', tmp_name, s, false);
+					ctx.add<var_predicate>(ctx.join({ block.name, "#redo" }));
+					ctx.add<inst_predicate>('A', var, s, false);
+					ctx.add<inst_predicate>('S', border, s, false);
+					ctx.add<inst_predicate>('E', ctx.join({ block.name, "#end" }), s, false);
+					ctx.add<inst_predicate>('T', "LAST_INSTRUCTION", s, false);
+					ctx.add<inst_predicate>('A', tmp_name, s, false);
+					block.body = predicates.size();
+					stack.push_back(block);
+					continue;
 				}
-				case 'r': {
-					if (!std::strncmp(str + i, "redo", 4) && std::isspace(str[i + 4])) {
-						i += 4;
-						char s = arguments.io == 2 ? 'F' : 'S';
-						auto & layer = stack.back();
-						predicates.push_back(std::make_unique<inst_predicate>('T', tmp_name, s, false));
-						predicates.push_back(std::make_unique<inst_predicate>('E', std::get<1>(layer) + "#redo", s, false));
-						continue;
-					}
+			}
+			[[fallthrough]];
+			case 'r': {
+				if (!std::strncmp(str + i, "return", 6) && std::isspace(str[i + 6])) {
+					// sub can't be inside of another block, so it is the first one
+					if (stack.empty() || stack.front().type != layer_t::subroutine)
+						throw std::runtime_error("return outside of sub");
+					i += 6;
+					char s = short_suffix(ctx.state.io);
+					add_jump(ctx, ctx.join({ stack.front().name, "#return" }), s);
+					continue;
 				}
-				case 'b': {
-					if (!std::strncmp(str + i, "break", 5) && std::isspace(str[i + 5])) {
-						i += 5;
-						char s = arguments.io == 2 ? 'F' : 'S';
-						auto & layer = stack.back();
-						predicates.push_back(std::make_unique<inst_predicate>('T', tmp_name, s, false));
-						predicates.push_back(std::make_unique<inst_predicate>('E', std::get<1>(layer) + "#end", s, false));
-						continue;
+				if (!std::strncmp(str + i, "redo", 4) && std::isspace(str[i + 4])) {
+					i += 4;
+					char s = short_suffix(ctx.state.io);
+					auto & layer = innermost_loop(stack);
+					if (layer.type == layer_t::while_loop)
+						add_jump(ctx, ctx.join({ layer.name, "#test" }), s);
+					else {
+						ctx.add<inst_predicate>('T', tmp_name, s, false);
+						ctx.add<inst_predicate>('E', ctx.join({ layer.name, "#redo" }), s, false);
 					}
+					continue;
 				}
-				case 'c': {
-					if (!std::strncmp(str + i, "continue", 8) && std::isspace(str[i + 8])) {
-						i += 8;
-						char s = arguments.io == 2 ? 'F' : 'S';
-						auto & layer = stack.back();
-						predicates.push_back(std::make_unique<inst_predicate>('E', std::get<1>(layer) + "#cont", s, false));
-						predicates.push_back(std::make_unique<inst_predicate>('G', std::get<1>(layer) + "#cont", s, false));
-						continue;
+			}
+			[[fallthrough]];
+			case 'b': {
+				if (!std::strncmp(str + i, "break", 5) && std::isspace(str[i + 5])) {
+					i += 5;
+					char s = short_suffix(ctx.state.io);
+					auto & layer = innermost_loop(stack);
+					if (layer.type == layer_t::while_loop && layer.acc == acc_t::kept)
+						add_jump(ctx, ctx.join({ layer.name, "#end" }), s);
+					else {
+						// the accumulator is restored after the loop
+						ctx.add<inst_predicate>('T', tmp_name, s, false);
+						ctx.add<inst_predicate>('E', ctx.join({ layer.name, layer.type == layer_t::while_loop ? "#exit" : "#end" }), s, false);
 					}
+					continue;
 				}
-				case 'e': {
-					if (!std::strncmp(str + i, "end", 3) && std::isspace(str[i + 3])) {
-						i += 3;
-						skip_space(str, i);
-						char s = arguments.io == 2 ? 'F' : 'S';
-						auto & layer = stack.back();
-						switch (std::get<0>(layer)) {
-							case layer_t::for_loop:
-								predicates.push_back(std::make_unique<var_predicate>(std::get<1>(layer) + "#cont"));
-								predicates.push_back(std::make_unique<inst_predicate>('T', tmp_name, s, false));
-								predicates.push_back(std::make_unique<inst_predicate>('A', std::get<2>(layer), s, false));
-								predicates.push_back(std::make_unique<inst_predicate>('A', "STEP", s, false));
-								predicates.push_back(std::make_unique<inst_predicate>('T', std::get<2>(layer), s, false));
-								predicates.push_back(std::make_unique<inst_predicate>('E', std::get<1>(layer) + "#redo", s, false));
-								predicates.push_back(std::make_unique<var_predicate>(std::get<1>(layer) + "#end"));
-								predicates.push_back(std::make_unique<inst_predicate>('T', "LAST_INSTRUCTION", s, false));
-								predicates.push_back(std::make_unique<inst_predicate>('A', tmp_name, s, false));
-								break;
-						}
-						stack.pop_back();
-						continue;
+			}
+			[[fallthrough]];
+			case 'c': {
+				if (!std::strncmp(str + i, "call", 4) && std::isspace(str[i + 4])) {
+					const char * at = str + i;
+					i += 4;
+					skip_space(str, i);
+					char s = short_suffix(ctx.state.io);
+					std::string_view name = read_name(str + i, "sub name expected after call");
+					i += name.size();
+					bool in_loop = std::any_of(stack.begin(), stack.end(), [](const layer & l) {
+						return l.type == layer_t::for_loop || l.type == layer_t::while_loop;
+					});
+					// the link is made in the accumulator, so it must be clear
+					if (!is_acc_clear(ctx))
+						ctx.add<inst_predicate>('T', "LAST_INSTRUCTION", s, false);
+					// A n F with its own address, sub turns it into the return jump E n+2 F
+					std::string_view link = ctx.label({ in_loop ? call_loop_prefix : call_prefix }, at);
+					ctx.add<var_predicate>(link);
+					ctx.add<inst_predicate>('A', link, s, false);
+					ctx.add<inst_predicate>('G', name, s, false);
+					continue;
+				}
+				if (!std::strncmp(str + i, "continue", 8) && std::isspace(str[i + 8])) {
+					i += 8;
+					char s = short_suffix(ctx.state.io);
+					auto & layer = innermost_loop(stack);
+					add_jump(ctx, ctx.join({ layer.name, layer.type == layer_t::while_loop ? "#test" : "#cont" }), s);
+					continue;
+				}
+			}
+			[[fallthrough]];
+			case 'e': {
+				if (!std::strncmp(str + i, "endsub", 6) && std::isspace(str[i + 6])) {
+					if (stack.empty() || stack.back().type != layer_t::subroutine)
+						throw std::runtime_error(stack.empty() ? "endsub without sub" : "block inside of sub is not closed by end");
+					i += 6;
+					char s = short_suffix(ctx.state.io);
+					auto & layer = stack.back();
+					// the return jump is stored here when sub is called
+					ctx.add<var_predicate>(ctx.join({ layer.name, "#return" }));
+					ctx.add<inst_predicate>('E', 0, s, false);
+					// the same word as RETURN of Initial Orders 2, Initial Orders 1 don't have it
+					ctx.add<var_predicate>(ctx.join({ layer.name, "#link" }));
+					ctx.add<inst_predicate>('U', 2, s, false);
+					ctx.add<var_predicate>(ctx.join({ layer.name, "#skip" }));
+					stack.pop_back();
+					continue;
+				}
+				if (!std::strncmp(str + i, "else", 4) && std::isspace(str[i + 4])) {
+					if (stack.empty() || stack.back().type != layer_t::if_then)
+						throw std::runtime_error("else without if");
+					i += 4;
+					char s = short_suffix(ctx.state.io);
+					auto & layer = stack.back();
+					add_jump(ctx, ctx.join({ layer.name, "#end" }), s);
+					ctx.add<var_predicate>(ctx.join({ layer.name, "#else" }));
+					add_restore(ctx, layer.acc, s);
+					layer.type = layer_t::if_else;
+					continue;
+				}
+				if (!std::strncmp(str + i, "end", 3) && std::isspace(str[i + 3])) {
+					if (stack.empty())
+						throw std::runtime_error("no block to close by end");
+					i += 3;
+					skip_space(str, i);
+					char s = short_suffix(ctx.state.io);
+					auto & layer = stack.back();
+					switch (layer.type) {
+						case layer_t::for_loop:
+							if (layer.from >= 0 && layer.to >= 0 && !layer.checks.empty() && keeps_variable(ctx, layer)) {
+								// the variable is in [from, to) in the whole body
+								for (size_t k : layer.checks) {
+									auto & check = static_cast<var_predicate &>(*predicates[k]);
+									check.name = ctx.join({ below_prefix, std::to_string(layer.to), "#", check.name.substr(check_prefix.size()) });
+								}
+							}
+							ctx.add<var_predicate>(ctx.join({ layer.name, "#cont" }));
+							ctx.add<inst_predicate>('T', tmp_name, s, false);
+							ctx.add<inst_predicate>('A', layer.var, s, false);
+							ctx.add<inst_predicate>('A', "STEP", s, false);
+							ctx.add<inst_predicate>('T', layer.var, s, false);
+							ctx.add<inst_predicate>('E', ctx.join({ layer.name, "#redo" }), s, false);
+							ctx.add<var_predicate>(ctx.join({ layer.name, "#end" }));
+							ctx.add<inst_predicate>('T', "LAST_INSTRUCTION", s, false);
+							ctx.add<inst_predicate>('A', tmp_name, s, false);
+							break;
+						case layer_t::if_then:
+							// the way around the body restores the accumulator too
+							if (layer.acc != acc_t::kept) {
+								add_jump(ctx, ctx.join({ layer.name, "#end" }), s);
+								ctx.add<var_predicate>(ctx.join({ layer.name, "#else" }));
+								add_restore(ctx, layer.acc, s);
+							} else
+								ctx.add<var_predicate>(ctx.join({ layer.name, "#else" }));
+							ctx.add<var_predicate>(ctx.join({ layer.name, "#end" }));
+							break;
+						case layer_t::if_else:
+							ctx.add<var_predicate>(ctx.join({ layer.name, "#end" }));
+							break;
+						case layer_t::subroutine:
+							throw std::runtime_error("sub is closed by endsub, not by end");
+						case layer_t::while_loop:
+							// the condition is tested after the body, so a loop takes one jump for every pass
+							ctx.add<var_predicate>(ctx.join({ layer.name, "#test" }));
+							if (layer.acc == acc_t::saved)
+								ctx.add<inst_predicate>('T', tmp_name, s, false);
+							add_test(ctx, layer.condition, true, ctx.join({ layer.name, "#top" }), s);
+							ctx.add<var_predicate>(ctx.join({ layer.name, "#exit" }));
+							add_restore(ctx, layer.acc, s);
+							ctx.add<var_predicate>(ctx.join({ layer.name, "#end" }));
+							break;
 					}
+					stack.pop_back();
+					continue;
 				}
-				case '~': {
-					// preprocessor
-					i++;
+			}
+			[[fallthrough]];
+			case '~': {
+				// preprocessor
+				i++;
+				skip_space(str, i);
+				if (!std::strncmp(str + i, "io", 2) && std::isspace(str[i + 2])) {
+					i += 2;
 					skip_space(str, i);
-					if (!std::strncmp(str + i, "io", 2) && std::isspace(str[i + 2])) {
-						i += 2;
-						skip_space(str, i);
-						int io;
-						i += read_int(str + i, io);
-						if (!std::isspace(str[i]))
-							throw std::runtime_error("integer number expected after ~io directive");
-						if (io > 2 || io < 1)
-							throw std::runtime_error("Initial Orders " + std::to_string(i) + " not supported (~io)");
-						if (!predicates.empty())
-							throw std::runtime_error("Can't switch between Initial Orders type inside a programm");
-						arguments.io = io;
-					} else if (!std::strncmp(str + i, "use_special_vars", 16) && std::isspace(str[i + 16])) {
-						i += 16;
-						create_edsacc_vars(predicates);
-					} else if (!std::strncmp(str + i, "define", 6) && std::isspace(str[i + 6])) {
-						i += 6;
-						skip_space(str, i);
-						int sz = find_word_end(str + i);
-						std::string name = std::string(str + i, sz);
-						i += sz;
-						skip_space(str, i);
-						int j = i;
-						next_line(str, j);
-						int k = j;
-						for (j--; std::isspace(str[j]); j--);
-						j++;
-						std::string value = std::string(str + i, j - i);
-						std::stringstream stream(value);
-						std::string resolved_value;
-						while (stream) {
-							std::string word;
-							stream >> word;
-							auto iter = defines.find(word);
-							if (iter != defines.end())
-								resolved_value = iter->second + ' ';
-							else
-								resolved_value += word + ' ';
-						}
-						defines[name] = resolved_value;
-						// resolve defines for this new one
-						stream = std::stringstream(str + k);
-						while (stream) {
-							throw std::runtime_error("not implemented yet");
-						}
-					} else
-						throw std::runtime_error("no such preprocessor directive in edsacc");
-					next_line(str, i);
+					int io;
+					i += read_int(str + i, io);
+					if (!std::isspace(str[i]))
+						throw std::runtime_error("integer number expected after ~io directive");
+					if (io > 2 || io < 1)
+						throw std::runtime_error("Initial Orders " + std::to_string(i) + " not supported (~io)");
+					if (ctx.state.has_predicates || !predicates.empty())
+						throw std::runtime_error("Can't switch between Initial Orders type inside a programm");
+					ctx.state.io = io;
+				} else if (!std::strncmp(str + i, "use_special_vars", 16) && std::isspace(str[i + 16])) {
+					i += 16;
+					create_edsacc_vars(ctx);
+				} else if (!std::strncmp(str + i, "include", 7) && std::isspace(str[i + 7])) {
+					i += 7;
+					skip_space(str, i);
+					if (str[i] != '"')
+						throw std::runtime_error("file name in quotes expected after ~include directive");
+					int sz = find_char(str + i + 1, '"');
+					include_file(std::string(str + i + 1, sz), ctx);
+					i += sz + 2;
+				} else
+					// ~define and ~undef are removed by preprocess
+					throw std::runtime_error("no such preprocessor directive in edsacc");
+				next_line(str, i);
+				continue;
+			}
+			case 'C': {
+				// maybe const
+				if (!std::strncmp(str + i, "CONST(", 6)) {
+					i += parse_as_const(str + i, ctx);
 					continue;
 				}
-				case 'C': {
-					// maybe const
-					if (!std::strncmp(str + i, "CONST(", 6)) {
-						i += parse_as_const(str + i, predicates);
-						continue;
-					}
+			}
+			[[fallthrough]];
+			case 'i': {
+				if (!std::strncmp(str + i, "if", 2) && std::isspace(str[i + 2])) {
+					const char * at = str + i;
+					i += 2;
+					char s = short_suffix(ctx.state.io);
+					layer block{ layer_t::if_then, ctx.label({ "if#" }, at) };
+					condition_t cond;
+					i += parse_condition(str + i, cond, block.acc);
+					skip_space(str, i);
+					if (std::strncmp(str + i, "then", 4) || !std::isspace(str[i + 4]))
+						throw std::runtime_error("'then' expected after condition of if");
+					i += 4;
+					if (block.acc == acc_t::saved && is_acc_clear(ctx))
+						block.acc = acc_t::cleared;
+					block.begin = predicates.size();
+					if (block.acc == acc_t::saved)
+						ctx.add<inst_predicate>('T', tmp_name, s, false);
+					// the body goes right after the test, the jump is taken only if the condition is false
+					add_test(ctx, cond, false, ctx.join({ block.name, "#else" }), s);
+					add_restore(ctx, block.acc, s);
+					stack.push_back(block);
+					continue;
+				}
+			}
+			[[fallthrough]];
+			case 'w': {
+				if (!std::strncmp(str + i, "while", 5) && std::isspace(str[i + 5])) {
+					const char * at = str + i;
+					i += 5;
+					char s = short_suffix(ctx.state.io);
+					layer block{ layer_t::while_loop, ctx.label({ "while#" }, at) };
+					i += parse_condition(str + i, block.condition, block.acc);
+					skip_space(str, i);
+					if (str[i] != 'd' || str[i + 1] != 'o' || !std::isspace(str[i + 2]))
+						throw std::runtime_error("'do' expected after condition of while");
+					i += 2;
+					block.begin = predicates.size();
+					add_jump(ctx, ctx.join({ block.name, "#test" }), s);
+					ctx.add<var_predicate>(ctx.join({ block.name, "#top" }));
+					add_restore(ctx, block.acc, s);
+					stack.push_back(block);
+					continue;
+				}
+			}
+			[[fallthrough]];
+			case 's': {
+				if (!std::strncmp(str + i, "sub", 3) && std::isspace(str[i + 3])) {
+					const char * at = str + i;
+					if (!stack.empty())
+						throw std::runtime_error("sub can't be inside of another block");
+					i += 3;
+					skip_space(str, i);
+					char s = short_suffix(ctx.state.io);
+					std::string_view name = read_name(str + i, "name expected after sub");
+					ctx.declarations.emplace_back(name, i);
+					i += name.size();
+					layer block{ layer_t::subroutine, ctx.label({ sub_prefix }, at), name };
+					// the program goes around the subroutine
+					std::string_view skip = ctx.join({ block.name, "#skip" });
+					ctx.add<inst_predicate>('E', skip, s, false);
+					ctx.add<inst_predicate>('G', skip, s, false);
+					// Wheeler jump: the caller has A n F in the accumulator and it becomes E n+2 F
+					ctx.add<var_predicate>(name);
+					ctx.add<inst_predicate>('A', ctx.join({ block.name, "#link" }), s, false);
+					ctx.add<inst_predicate>('T', ctx.join({ block.name, "#return" }), s, false);
+					block.begin = predicates.size();
+					stack.push_back(block);
+					continue;
 				}
-				default:
-					break;
 			}
+			default:
+				break;
+		}
 
-			// maybe instruction
-			if (int(inst_list.find_first_of(str[i])) >= 0) {
-				i += parse_as_inst(str + i, predicates);
-				continue;
+		// maybe instruction
+		if (int(inst_list.find_first_of(str[i])) >= 0) {
+			i += parse_as_inst(str + i, ctx);
+			continue;
+		}
+		
+		// something else
+		std::string_view word(str + i, word_sz);
+		ctx.warnings.emplace_back(i, "not parsable word \"" + std::string(word) + "\"");
+		ctx.add<txt_predicate>(word);
+
+		i = j;
+	}
+	ctx.state.has_predicates = ctx.state.has_predicates || !predicates.empty();
+}
+
+bool is_position_dependent(const predicate_t & p) {
+	// G K and G Z orders take their own address into the relocation offset
+	auto command = dynamic_cast<const command_predicate *>(&p);
+	return command && command->prefix == 'G' && (command->suffics == 'K' || command->suffics == 'Z');
+}
+
+// predicates that are linked and written by one thread
+constexpr size_t link_block_size = 1 << 12;
+
+void link(const std::vector<predicate_t *> & predicates, const vars_t & vars, int io, std::ostream & out, unsigned jobs) {
+	target_io = io;
+	int offset = 0;
+	std::exception_ptr error;
+	auto stop = relocate(predicates.begin(), predicates.end(), vars, offset, error);
+	size_t n = stop - predicates.begin();
+	size_t blocks_n = (n + link_block_size - 1) / link_block_size;
+	if (jobs < 2 || blocks_n < 2) {
+		for (auto iter = predicates.begin(); iter != stop; ++iter)
+			(*iter)->resolve(vars);
+		if (error)
+			std::rethrow_exception(error);
+		if (arguments.format == format_t::image)
+			write_image(out, predicates, vars, io);
+		else {
+			write_header(out, io);
+			for (auto & p : predicates)
+				p->write_to(out);
+			write_vars(out, vars);
+		}
+		return;
+	}
+
+	struct block_t {
+		std::ostringstream tape;
+		std::ostringstream messages;
+		std::exception_ptr error;
+	};
+	std::vector<block_t> blocks(blocks_n);
+	parallel_for(blocks_n, jobs, [&](size_t k) {
+		block_t & block = blocks[k];
+		std::ostream * stream = edsac::err;
+		edsac::err = &block.messages;
+		target_io = io;
+		size_t begin = k * link_block_size;
+		size_t end = std::min(n, begin + link_block_size);
+		try {
+			for (size_t i = begin; i < end; i++)
+				predicates[i]->resolve(vars);
+			// a tape is written only if the whole program is linked, an image is assembled by one thread
+			if (!error && arguments.format == format_t::text)
+				for (size_t i = begin; i < end; i++)
+					predicates[i]->write_to(block.tape);
+		} catch (...) {
+			block.error = std::current_exception();
+		}
+		edsac::err = stream;
+	});
+	for (auto & block : blocks) {
+		*err << block.messages.str();
+		if (block.error)
+			std::rethrow_exception(block.error);
+	}
+	if (error)
+		std::rethrow_exception(error);
+	if (arguments.format == format_t::image)
+		return write_image(out, predicates, vars, io);
+	write_header(out, io);
+	for (auto & block : blocks)
+		out << block.tape.str();
+	write_vars(out, vars);
+}
+
+// a source is split into chunks for threads only if every chunk has at least that many bytes
+constexpr int min_chunk_size = 1 << 16;
+// directives that change the parser state are usually at the top, this much is parsed before other chunks
+constexpr int head_size = 1 << 12;
+
+// initial size of an arena for a part of the source, it is enough for usual programs
+std::size_t arena_size(int source_size) {
+	return std::max<std::size_t>(1 << 12, std::size_t(source_size) * 32);
+}
+
+// A part of the source that begins at a line returned by line_splitter,
+// it is parsed, initialized and linked on its own.
+struct chunk_t {
+	int begin;
+	int end;
+	parse_state entry;
+	// everything parsed from the chunk, a thread allocates only from the arena of its chunk
+	std::pmr::monotonic_buffer_resource memory;
+	parse_context ctx;
+	// position of the parse error
+	int i;
+	std::exception_ptr error;
+	// positions of errors and warnings are counted in the source before preprocess
+	const char * source;
+	const source_map * map;
+	vars_t vars{ &memory };
+	int address = 0;
+	int size = 0;
+	// declared names in the order of declarations, it defines the order of the vars section
+	std::vector<const std::string_view *> names;
+
+	chunk_t(const char * text, int b, int e, const char * source, const source_map & map) :
+		begin(b), end(e), entry{ 0 }, memory(arena_size(e - b)), ctx(text, 0, 0, entry, &memory), source(source), map(&map) {}
+
+	void parse(const parse_state & state) {
+		// positions and generated names are taken from the whole text, so they are the same as in one piece
+		entry = state;
+		ctx = parse_context(ctx.text, 0, 0, state, &memory);
+		ctx.source = source;
+		ctx.map = map;
+		i = begin;
+		error = nullptr;
+		try {
+			parse_source(i, end, ctx);
+		} catch (...) {
+			error = std::current_exception();
+		}
+	}
+
+	// addresses relative to the chunk, false if a name is declared twice
+	bool count() {
+		try {
+			for (auto & p : ctx.predicates) {
+				size = p->initialize(size, vars);
+				if (const std::string_view * name = p->definition())
+					names.push_back(name);
 			}
-			
-			// something else
-			auto pos = count_lines(str, i);
-			std::string word(str + i, word_sz);
-			err << "warning:" << pos.first << ':' << pos.second << ": not parsable word \"" + word << "\"" << std::endl;
-			predicates.push_back(std::make_unique<txt_predicate>(word));
+			return true;
+		} catch (const std::exception &) {
+			return false;
+		}
+	}
 
-			i = j;
+	void initialize() {
+		vars.clear();
+		int at = address;
+		for (auto & p : ctx.predicates)
+			at = p->initialize(at, vars);
+	}
+};
+
+std::vector<int> split_chunks(const char * str, int size, unsigned jobs) {
+	std::vector<int> bounds{ 0 };
+	if (jobs > 1 && size >= 2 * min_chunk_size) {
+		// more chunks than threads, so a slow chunk does not keep the others waiting
+		int chunk_size = std::max(min_chunk_size, size / int(jobs * 4));
+		line_splitter splitter(str, size);
+		for (int at = splitter.next(), next = head_size; at < size; at = splitter.next()) {
+			if (at >= next) {
+				bounds.push_back(at);
+				next = at + chunk_size;
+			}
 		}
+	}
+	bounds.push_back(size);
+	return bounds;
+}
+
+int parser::parse(std::ostream & err) {
+	edsac::err = &err;
+
+	std::string source( (std::istreambuf_iterator<char>(input)), (std::istreambuf_iterator<char>()) );
+	// macros are expanded in the whole text, so chunks do not depend on each other through them
+	macro_table macros;
+	source_map map;
+	int at = 0;
+	std::string text;
+	try {
+		text = preprocess(source, at, macros, "", &map);
 	} catch (const std::exception & e) {
-		auto pair = count_lines(str, i);
+		auto pair = count_lines(source.c_str(), at);
 		err << "compilation error:" << pair.first << ":" << pair.second << ": " << e.what() << std::endl;
 		return 1;
 	}
-	
+	unsigned jobs = arguments.jobs;
+	std::vector<int> bounds = split_chunks(text.c_str(), text.size(), jobs);
+	std::vector<std::unique_ptr<chunk_t>> chunks;
+	for (size_t k = 0; k + 1 < bounds.size(); k++)
+		chunks.push_back(std::make_unique<chunk_t>(text.c_str(), bounds[k], bounds[k + 1], source.c_str(), map));
+	size_t n = chunks.size();
+
+	// The head is parsed first and the other chunks start from the state after it.
+	// Chunks are checked in order and the ones that started from another state are parsed again.
+	parse_state state{ arguments.io };
+	chunks[0]->parse(state);
+	if (!chunks[0]->error && n > 1) {
+		parse_state guess = chunks[0]->ctx.state;
+		parallel_for(n - 1, jobs, [&](size_t k) {
+			parse_state entry = guess;
+			entry.has_predicates = guess.has_predicates || k > 0;
+			chunks[k + 1]->parse(entry);
+		});
+	}
+	bool split = false;
+	for (auto & c : chunks) {
+		if (c->entry != state)
+			c->parse(state);
+		if (c->error || !c->ctx.stack.empty()) {
+			split = true;
+			break;
+		}
+		state = c->ctx.state;
+	}
+	if (split && n > 1) {
+		// a block or an error crosses a chunk border, so the text is parsed again in one piece
+		chunks.clear();
+		chunks.push_back(std::make_unique<chunk_t>(text.c_str(), 0, text.size(), source.c_str(), map));
+		n = 1;
+		chunks[0]->parse(parse_state{ arguments.io });
+	}
+	state = parse_state{ arguments.io };
+	for (auto & c : chunks) {
+		c->ctx.write_warnings(err);
+		if (c->error) {
+			auto pair = c->ctx.position(c->i);
+			try {
+				std::rethrow_exception(c->error);
+			} catch (const std::exception & e) {
+				err << "compilation error:" << pair.first << ":" << pair.second << ": " << e.what() << std::endl;
+			}
+			return 1;
+		}
+		state = c->ctx.state;
+	}
+	arguments.io = state.io;
+
+	std::vector<predicate_t *> all;
+	size_t total = 0;
+	for (auto & c : chunks)
+		total += c->ctx.predicates.size();
+	all.reserve(total);
+	for (auto & c : chunks)
+		for (auto & p : c->ctx.predicates)
+			all.push_back(p.get());
+	if (arguments.object) {
+		// names are resolved when the object is linked
+		write_object(output, all, source_texts(text, state), arguments.io);
+		return 0;
+	}
+
+	// names and addresses of the program, copies of inlined subroutines
+	std::pmr::monotonic_buffer_resource memory;
 	try {
-		// initialize
-		std::unordered_map<std::string, int> vars;
-		int n = (arguments.io == 1) ? 31 : 44;
-		for (auto & p : predicates)
-			n = p->initialize(n, vars);
-		vars["LAST_INSTRUCTION"] = n;
-		if (arguments.io == 2) {
-			vars["ONE"] = 2;
-			vars["RETURN"] = 3;
-			vars["ZERO"] = 41;
-		}
-		// link
-		for (auto & p : predicates)
-			p->resolve(vars);
-		// write
-		if (arguments.debug)
-			output << "[Initial Orders " << arguments.io << ']' << std::endl;
-		for (auto & p : predicates)
-			p->write_to(output);
-		if (arguments.debug) {
-			output << "[-------------]" << std::endl << "[VARS SECTION]" << std::endl;
-			for (auto & var : vars) {
-				output << "[-> " << var.first << "=" << var.second << "]" << std::endl;
+		// chunks don't have the predicates of the program any more if checks are removed or subroutines are inlined
+		bool changed = false;
+		if (arguments.bounds_check) {
+			bounds_checks_t checks;
+			changed = eliminate_bounds_checks(all, checks);
+			// only with -d, the output without warnings is cached
+			if (arguments.debug)
+				err << checks << std::endl;
+		}
+		changed = (arguments.optimize && inline_subroutines(all, &memory, arguments.io)) || changed;
+		if (!arguments.targets.empty()) {
+			link_targets(all, output, jobs);
+			return 0;
+		}
+		// initialize, chunk addresses are a prefix sum of their sizes
+		vars_t vars(&memory);
+		int base = base_address(arguments.io);
+		bool parallel = n > 1 && !changed;
+		if (parallel) {
+			std::vector<char> counted(n);
+			parallel_for(n, jobs, [&](size_t k) { counted[k] = chunks[k]->count(); });
+			parallel = std::find(counted.begin(), counted.end(), false) == counted.end();
+		}
+		if (parallel) {
+			std::vector<int> sizes(n);
+			for (size_t k = 0; k < n; k++)
+				sizes[k] = chunks[k]->size;
+			std::exclusive_scan(sizes.begin(), sizes.end(), sizes.begin(), base);
+			parallel_for(n, jobs, [&](size_t k) {
+				chunks[k]->address = sizes[k];
+				chunks[k]->initialize();
+			});
+			for (size_t k = 0; k < n && parallel; k++) {
+				for (const std::string_view * name : chunks[k]->names) {
+					if (!vars.emplace(*name, chunks[k]->vars[*name]).second) {
+						parallel = false;
+						break;
+					}
+				}
 			}
 		}
+		int last = base;
+		if (parallel) {
+			last = chunks.back()->address + chunks.back()->size;
+		} else {
+			// one chunk, or the error message must name the same variable as without chunks
+			vars.clear();
+			for (auto & p : all)
+				last = p->initialize(last, vars);
+		}
+		define_constants(vars, last, arguments.io);
+
+		link(all, vars, arguments.io, output, jobs);
 	} catch (const std::exception & e) {
 		err << "link time error: " << e.what() << std::endl;
 		return 2;
@@ -928,4 +2130,117 @@ int parser::parse(std::ostream & err) {
 	return 0;
 }
 
+// Initial Orders 1 start a program from its first word, so E m K of Initial Orders 2 becomes a jump from there
+void move_entry(predicates_t & copies, std::vector<predicate_t *> & predicates, std::pmr::memory_resource * memory) {
+	auto entry = std::find_if(predicates.begin(), predicates.end(), [](const predicate_t * p) {
+		auto direct = dynamic_cast<const direct_predicate *>(p);
+		return direct && direct->prefix == 'E' && direct->suffics == 'K';
+	});
+	if (entry == predicates.end())
+		return;
+	auto addr = static_cast<const command_predicate *>(*entry)->addr;
+	predicates.erase(entry);
+	for (const auto & order : { inst_predicate('T', std::string_view("LAST_INSTRUCTION"), short_suffix(2), false),
+			inst_predicate('E', addr, short_suffix(2), false) })
+		copies.emplace_back(order.copy(memory));
+	predicates.insert(predicates.begin(), { copies[copies.size() - 2].get(), copies.back().get() });
+}
+
+void link_targets(const std::vector<predicate_t *> & predicates, std::ostream & out, unsigned jobs) {
+	struct target_t {
+		std::pmr::monotonic_buffer_resource memory;
+		std::ostringstream program;
+		std::ostringstream messages;
+		std::exception_ptr error;
+	};
+	const std::vector<int> & targets = arguments.targets;
+	std::vector<target_t> results(targets.size());
+	std::ostream * stream = edsac::err;
+	// addresses are kept in predicates, so every target links its own copies
+	parallel_for(targets.size(), targets.size(), [&](size_t k) {
+		target_t & target = results[k];
+		int io = targets[k];
+		edsac::err = &target.messages;
+		try {
+			predicates_t copies;
+			std::vector<predicate_t *> all;
+			copies.reserve(predicates.size());
+			all.reserve(predicates.size());
+			for (const predicate_t * p : predicates) {
+				copies.emplace_back(p->copy(&target.memory));
+				all.push_back(copies.back().get());
+			}
+			if (io == 1)
+				move_entry(copies, all, &target.memory);
+			vars_t vars(&target.memory);
+			int last = base_address(io);
+			for (predicate_t * p : all)
+				last = p->initialize(last, vars);
+			define_constants(vars, last, io);
+			link(all, vars, io, target.program, std::max(1u, jobs / unsigned(targets.size())));
+		} catch (const std::exception & e) {
+			target.error = std::make_exception_ptr(std::runtime_error("Initial Orders " + std::to_string(io) + ": " + e.what()));
+		}
+	});
+	edsac::err = stream;
+	for (auto & target : results) {
+		*err << target.messages.str();
+		if (target.error)
+			std::rethrow_exception(target.error);
+	}
+	for (size_t k = 0; k < targets.size(); k++) {
+		if (arguments.output.empty()) {
+			out << results[k].program.str();
+			if (arguments.format == format_t::text)
+				out << std::endl;
+		}
+		else {
+			std::string path = target_path(arguments.output, targets[k]);
+			std::ofstream file(path, arguments.output_mode());
+			if (!(file << results[k].program.str()))
+				throw std::runtime_error("can't write '" + path + "'");
+		}
+	}
+}
+
+std::string target_path(const std::string & output, int io) {
+	std::filesystem::path path(output);
+	std::string extension = path.extension().string();
+	return path.replace_extension(".io" + std::to_string(io) + extension).string();
+}
+
+int base_address(int io) {
+	return (io == 1) ? 31 : 44;
+}
+
+void define_constants(vars_t & vars, int last_instruction, int io) {
+	vars["LAST_INSTRUCTION"] = last_instruction;
+	if (io == 2) {
+		vars["ONE"] = 2;
+		vars["RETURN"] = 3;
+		vars["ZERO"] = 41;
+	}
+}
+
+void write_header(std::ostream & out, int io) {
+	if (arguments.debug)
+		out << "[Initial Orders " << io << ']' << std::endl;
+}
+
+void write_image(std::ostream & out, const std::vector<predicate_t *> & predicates, const vars_t & vars, int io) {
+	store_image image;
+	for (auto & p : predicates)
+		p->assemble(image);
+	image.write(out, vars, io);
+}
+
+void write_vars(std::ostream & out, const vars_t & vars) {
+	if (arguments.debug) {
+		out << "[-------------]" << std::endl << "[VARS SECTION]" << std::endl;
+		for (auto & var : vars) {
+			out << "[-> " << var.first << "=" << var.second << "]" << std::endl;
+		}
+	}
+}
+
 }
@@ -1,5 +1,20 @@
+#ifndef PARSER_H
+#define PARSER_H
+
 #include <istream>
 #include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <tuple>
+#include <utility>
+#include <unordered_map>
+#include <exception>
+#include <memory_resource>
+#include <initializer_list>
+#include <new>
+
+#include "predicates.hpp"
 
 namespace edsac {
 
@@ -14,4 +29,197 @@ public:
     int parse(std::ostream & err);
 };
 
+struct module_t;
+class source_map;
+
+enum class layer_t {
+    for_loop, if_then, if_else, while_loop, subroutine
+};
+
+// what happens to the accumulator while a condition of if or while is tested
+enum class acc_t {
+    // the condition is the sign of the accumulator itself
+    kept,
+    // the accumulator was clear before the test, it is cleared after it
+    cleared,
+    // the accumulator is saved in edsacc#tmp before the test and restored after it
+    saved
+};
+
+// sign test of if and while, the accumulator gets add - sub and the condition is true
+// if it is negative or, when negative is false, if it is not negative; names are empty for 0
+struct condition_t {
+    std::string_view add;
+    std::string_view sub;
+    bool negative = false;
+};
+
+// block of for, if, while or sub that is not closed by end or endsub yet
+struct layer {
+    layer_t type;
+    // prefix of the labels generated for the block
+    std::string_view name;
+    // variable of for, name of sub
+    std::string_view var = {};
+    acc_t acc = acc_t::kept;
+    // condition of while, it is tested at the end of the loop
+    condition_t condition = {};
+    // first predicate of the block
+    size_t begin = 0;
+    // for: the variable is in [from, to) at the head of the loop if both are not negative
+    int from = -1;
+    int to = -1;
+    // for: first predicate of the body and the labels of bounds checks indexed by the variable
+    size_t body = 0;
+    std::vector<size_t> checks = {};
+};
+
+// everything that one part of a program passes to the next one
+struct parse_state {
+    int io;
+    bool special_vars = false;
+    bool has_predicates = false;
+    // files included with ~include, every file is included once
+    std::vector<const module_t *> included = {};
+
+    bool operator==(const parse_state & other) const {
+        return io == other.io && special_vars == other.special_vars && has_predicates == other.has_predicates &&
+            included == other.included;
+    }
+    bool operator!=(const parse_state & other) const { return !(*this == other); }
+};
+
+struct parse_context {
+    predicates_t predicates;
+    std::vector<layer> stack;
+    // warnings with their offsets in text, -1 if the warning has no position
+    std::vector<std::pair<int, std::string>> warnings;
+    // names declared in the source with their offsets in text
+    std::vector<std::pair<std::string_view, int>> declarations;
+    parse_state state;
+    // parsed text, its offset that makes generated names unique and its first line number
+    const char * text;
+    long long origin;
+    int line;
+    // part of generated names that makes them unique among included files, empty for the program
+    std::string_view unit;
+    // directory of the parsed file, the directory of the input file if it is empty
+    std::string_view directory;
+    // arena for predicates and generated names, it and the text must outlive the predicates
+    std::pmr::memory_resource * memory;
+    // the source before preprocess and the offset of text in its result, positions are counted in the source if it is set
+    const char * source = nullptr;
+    const source_map * map = nullptr;
+    int start = 0;
+
+    parse_context(const char * t, long long o, int l, const parse_state & s, std::pmr::memory_resource * m) :
+        state(s), text(t), origin(o), line(l), memory(m) {}
+
+    template <typename T, typename... Args>
+    void add(Args &&... args) {
+        void * p = memory->allocate(sizeof(T), alignof(T));
+        predicates.emplace_back(new (p) T(std::forward<Args>(args)...));
+    }
+    // concatenation of parts in the arena
+    std::string_view join(std::initializer_list<std::string_view> parts) const;
+    // name that is unique for the place in the source and the unit, the prefix has at most 3 parts
+    std::string_view label(std::initializer_list<std::string_view> prefix, const char * at) const;
+    // words of a constant in the arena
+    std::pmr::vector<std::pmr::string> words(std::initializer_list<std::string_view> list) const;
+    std::pair<int, int> position(int i) const;
+    void write_warnings(std::ostream & err) const;
+};
+
+// prefixes of the labels generated for sub and call, subroutines are inlined by them
+constexpr std::string_view sub_prefix = "sub#";
+constexpr std::string_view call_prefix = "call#";
+constexpr std::string_view call_loop_prefix = "call#loop#";
+// prefixes of the labels before the bounds checks of a[i] with --bounds-check, the check is
+// bounds#below#b#... if i is known to be in [0, b) there and a constant index k is bounds#index#k+1#...
+constexpr std::string_view check_prefix = "bounds#check#";
+constexpr std::string_view below_prefix = "bounds#below#";
+constexpr std::string_view index_prefix = "bounds#index#";
+
+// stream for warnings of the link phase
+extern thread_local std::ostream * err;
+// Initial Orders the program is linked and written for by the thread, link sets it.
+// Predicates keep the suffixes of the Initial Orders they are parsed for, arguments.io,
+// and they are converted only for the other one, so one parse is written for both of them.
+extern thread_local int target_io;
+// suffixes of generated short and long orders and words, S and L of Initial Orders 1 are F and D of Initial Orders 2
+constexpr char short_suffix(int io) { return io == 2 ? 'F' : 'S'; }
+constexpr char long_suffix(int io) { return io == 2 ? 'D' : 'L'; }
+// the suffix of a predicate as it is written for the target, a suffix of the target itself is not changed
+char target_suffix(char suffix, int io);
+// words of a tape like "P22DP0F" with suffixes for the target
+std::string target_text(std::string_view text, int io);
+
+// Reads an expression of numbers, names, + - * / << >> and parentheses from str and returns its length.
+// Spaces end it outside of parentheses unless spaces is true.
+int parse_expression(const char * str, parse_context & ctx, expression_t & expr, bool spaces = false);
+// parses text[i:size) into ctx, on exception i points to the place of the error
+void parse_source(int & i, int size, parse_context & ctx);
+// Finds the lines which do not start inside of a comment or a block,
+// the parser state at the beginning of every such line is the same.
+class line_splitter {
+private:
+    const char * str;
+    int size;
+    int i;
+
+    void skip_to(const char * end);
+
+public:
+    // begin must be 0 or a value returned by next
+    line_splitter(const char * s, int n, int begin = 0) : str(s), size(n), i(begin) {}
+
+    // start of the next such line, size at the end of the text
+    int next();
+};
+
+// Gives predicates their relocation offsets starting from offset, only G K and G Z orders change it.
+// Returns the predicate that failed to resolve its name, predicates before it can be resolved
+// in any order and the first error is the same as if all of them were resolved one by one.
+template <typename Iter>
+Iter relocate(Iter begin, Iter end, const vars_t & vars, int & offset, std::exception_ptr & error) {
+    try {
+        for (; begin != end; ++begin)
+            offset = (*begin)->relocate(vars, offset);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    return begin;
 }
+// Links predicates and writes the program to out, blocks of predicates are linked on up to jobs threads.
+// Warnings go to err in the order of predicates, the first link error is thrown before anything is written.
+void link(const std::vector<predicate_t *> & predicates, const vars_t & vars, int io, std::ostream & out, unsigned jobs);
+// Links copies of predicates for every Initial Orders of arguments.targets concurrently. The programs are written
+// to out one after another or, if there is an output file, to the files target_path gives.
+void link_targets(const std::vector<predicate_t *> & predicates, std::ostream & out, unsigned jobs);
+// output file of the program for the Initial Orders, prog.txt becomes prog.io1.txt
+std::string target_path(const std::string & output, int io);
+// G K and G Z orders, the only ones that change the relocation offset
+bool is_position_dependent(const predicate_t & p);
+// cells of ~use_special_vars, they are created once for a program
+void create_edsacc_vars(parse_context & ctx);
+// first of the special_vars_size predicates create_edsacc_vars adds
+bool is_special_vars(const predicate_t & p);
+constexpr int special_vars_size = 12;
+// words in the store, addresses of orders are less than it
+constexpr int store_size = 1024;
+int base_address(int io);
+void define_constants(vars_t & vars, int last_instruction, int io);
+void write_warnings(std::ostream & err, const char * text, int line, const std::vector<std::pair<int, std::string>> & warnings);
+// warnings of the text that starts at start in the result of preprocess, with positions in its source
+void write_warnings(std::ostream & err, const char * source, const source_map & map, int start, const std::vector<std::pair<int, std::string>> & warnings);
+// line and column of str[size], both start from 1
+std::pair<int, int> count_lines(const char * str, int size);
+void write_header(std::ostream & out, int io);
+void write_vars(std::ostream & out, const vars_t & vars);
+// assembles linked predicates into a store_image and writes it
+void write_image(std::ostream & out, const std::vector<predicate_t *> & predicates, const vars_t & vars, int io);
+
+}
+
+
+#endif // PARSER_H
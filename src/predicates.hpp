@@ -0,0 +1,176 @@
+#ifndef PREDICATES_H
+#define PREDICATES_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <variant>
+#include <memory_resource>
+#include <ostream>
+#include <new>
+#include <utility>
+
+namespace edsac {
+
+// names are views of the source or of generated names in the arena of its predicates
+typedef std::pmr::unordered_map<std::string_view, int> vars_t;
+
+class store_image;
+
+// Expression of an address or an initializer, names in it stand for their addresses.
+// The parser folds everything it can, so only the parts with names are left for link time.
+struct expression_t {
+	// postfix program, kind is 'n' for a number, 'v' for a name and + - * / < > for operators,
+	// < and > are shifts and _ is negation
+	struct op_t {
+		char kind;
+		// the number or the index of the name
+		int value;
+	};
+	const op_t * ops = nullptr;
+	int size = 0;
+	const std::string_view * names = nullptr;
+	int names_size = 0;
+	// the expression as it is written
+	std::string_view text;
+
+	int evaluate(const vars_t & vars) const;
+};
+
+typedef std::pair<const std::string_view *, const std::string_view *> names_t;
+
+struct predicate_t {
+	virtual int initialize(int inst_n, vars_t & vars) = 0;
+	// takes the relocation offset of Initial Orders 2 before the predicate and returns the one after it
+	virtual int relocate(const vars_t &, int offset) { return offset; }
+	// can be called again after addresses changed, relocate must be called first
+	virtual void resolve(const vars_t & vars) = 0;
+	virtual std::ostream & write_to(std::ostream & out) const = 0;
+	// puts the words the predicate loads into the store, called after resolve
+	virtual void assemble(store_image &) const {}
+	// names declared and used by the predicate, needed to find what to relink after changes
+	virtual const std::string_view * definition() const { return nullptr; }
+	virtual names_t references() const { return { nullptr, nullptr }; }
+	// predicates of an included file are parsed once and copied into every file that includes it
+	virtual predicate_t * copy(std::pmr::memory_resource * memory) const = 0;
+	virtual ~predicate_t() {}
+};
+
+template <typename T>
+predicate_t * copy_to(const T & p, std::pmr::memory_resource * memory) {
+	return new (memory->allocate(sizeof(T), alignof(T))) T(p);
+}
+
+// predicates are allocated in an arena, so they are only destroyed and their memory goes with the arena
+struct arena_delete {
+	template <typename T>
+	void operator()(T * p) const { p->~T(); }
+};
+
+typedef std::vector<std::unique_ptr<predicate_t, arena_delete>> predicates_t;
+
+// letters of the 5 bit order codes
+constexpr std::string_view char_table = "PQWERTYUIOJ#SZK*.F@D!HNM&LXGABCV";
+
+struct var_predicate final : public predicate_t {
+	std::string_view name;
+	var_predicate(std::string_view n) : name(n) {};
+	virtual int initialize(int inst_n, vars_t & vars) override;
+	virtual void resolve(const vars_t & vars) override;
+	virtual std::ostream & write_to(std::ostream & out) const override;
+	virtual predicate_t * copy(std::pmr::memory_resource * memory) const override { return copy_to(*this, memory); }
+	virtual const std::string_view * definition() const override { return &name; }
+};
+
+struct command_predicate : public predicate_t {
+	char prefix;
+	std::variant<std::string_view, int, expression_t> addr;
+	bool is_long;
+	char suffics;
+	int inst_address;
+	int address;
+	// relocation offset at the instruction
+	int offset = 0;
+	command_predicate(char pre, const std::variant<std::string_view, int, expression_t> & a, char post, bool l) :
+		prefix(pre), addr(a), is_long(l), suffics(post) {}
+	virtual int relocate(const vars_t & vars, int offset) final override;
+	virtual void resolve(const vars_t & vars) final override;
+	virtual std::ostream & write_to(std::ostream & out) const override;
+	virtual names_t references() const final override;
+};
+
+struct inst_predicate final : public command_predicate {
+	inst_predicate(char pre, const std::variant<std::string_view, int, expression_t> & a, char post, bool l) :
+		command_predicate(pre, a, post, l) {}
+	virtual int initialize(int inst_n, vars_t & vars) override;
+	virtual std::ostream & write_to(std::ostream & out) const override;
+	virtual predicate_t * copy(std::pmr::memory_resource * memory) const override { return copy_to(*this, memory); }
+	virtual void assemble(store_image & image) const override;
+};
+
+struct direct_predicate final : public command_predicate {
+	direct_predicate(char pre, const std::variant<std::string_view, int, expression_t> & a, char post, bool l) :
+		command_predicate(pre, a, post, l) {}
+	virtual int initialize(int inst_n, vars_t & vars) override;
+	virtual std::ostream & write_to(std::ostream & out) const override;
+	virtual predicate_t * copy(std::pmr::memory_resource * memory) const override { return copy_to(*this, memory); }
+	virtual void assemble(store_image & image) const override;
+};
+
+struct const_predicate final : public predicate_t {
+	// explicit words followed by a run of zero words, count includes both
+	std::pmr::vector<std::pmr::string> inst;
+	int count;
+	int zeros;
+	int inst_address;
+	const_predicate(std::pmr::vector<std::pmr::string> && i, int c, int z = 0) : inst(std::move(i)), count(c), zeros(z) {}
+	virtual int initialize(int inst_n, vars_t & vars) override;
+	virtual void resolve(const vars_t & vars) override;
+	virtual std::ostream & write_to(std::ostream & out) const override;
+	virtual predicate_t * copy(std::pmr::memory_resource * memory) const override { return copy_to(*this, memory); }
+	virtual void assemble(store_image & image) const override;
+};
+
+struct ptr_predicate final : public predicate_t {
+	std::string_view var;
+	int inst_address;
+	int first_element;
+	ptr_predicate(std::string_view name) : var(name) {}
+	virtual int initialize(int inst_n, vars_t & vars) override;
+	virtual void resolve(const vars_t & vars) override;
+	virtual std::ostream & write_to(std::ostream & out) const override;
+	virtual predicate_t * copy(std::pmr::memory_resource * memory) const override { return copy_to(*this, memory); }
+	virtual void assemble(store_image & image) const override;
+	virtual names_t references() const override { return { &var, &var + 1 }; }
+};
+
+// one word, or two for the l suffix, with a value that is known at link time
+struct expr_predicate final : public predicate_t {
+	expression_t expr;
+	char suffix;
+	int inst_address;
+	int value;
+	expr_predicate(const expression_t & e, char s) : expr(e), suffix(s) {}
+	virtual int initialize(int inst_n, vars_t & vars) override;
+	virtual void resolve(const vars_t & vars) override;
+	virtual std::ostream & write_to(std::ostream & out) const override;
+	virtual predicate_t * copy(std::pmr::memory_resource * memory) const override { return copy_to(*this, memory); }
+	virtual void assemble(store_image & image) const override;
+	virtual names_t references() const override { return { expr.names, expr.names + expr.names_size }; }
+};
+
+struct txt_predicate final : public predicate_t {
+	std::string_view text;
+	txt_predicate(std::string_view str) : text(str) {}
+	virtual int initialize(int inst_n, vars_t & vars) override;
+	virtual void resolve(const vars_t & vars) override;
+	virtual std::ostream & write_to(std::ostream & out) const override;
+	virtual predicate_t * copy(std::pmr::memory_resource * memory) const override { return copy_to(*this, memory); }
+};
+
+} // edsac
+
+
+#endif // PREDICATES_H
@@ -0,0 +1,368 @@
+#!/bin/sh
+# Regression checks of edsacc: sh tests/regress.sh [path to edsacc]
+# Every check prints its name and FAIL if the output is not the expected one.
+
+EDSACC=$(realpath "${1:-./edsacc}")
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+failed=0
+
+check() {
+    if [ "$2" = 0 ]; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1"
+        failed=1
+    fi
+}
+
+# the label end used as an address inside for and else blocks is not the end of a block
+cat > end.txt <<'EOF'
+T LAST_INSTRUCTION F
+E start F
+$N = 5
+~use_special_vars
+start:
+    for $i=0, 3 do
+        E end F
+        A N F
+    end
+    if N < 0 then
+        A (N + 1) F
+    else
+        E end F
+    end
+end: ZF
+EOF
+sed 's/\bend\b\( F\|:\)/fin\1/' end.txt > fin.txt
+"$EDSACC" --input=end.txt > end.tape 2> end.err && "$EDSACC" --input=fin.txt > fin.tape &&
+    cmp -s end.tape fin.tape && [ ! -s end.err ]
+check "E end F inside for and else" $?
+
+# the same in --lsp, where the text is split into regions by lines
+message() {
+    printf 'Content-Length: %d\r\n\r\n%s' "$(printf '%s' "$1" | wc -c)" "$1"
+}
+json_text() {
+    awk '{ printf "%s\\n", $0 }' "$1"
+}
+text=$(json_text end.txt)
+{
+    message '{"jsonrpc":"2.0","id":1,"method":"initialize","params":{}}'
+    message '{"jsonrpc":"2.0","method":"textDocument/didOpen","params":{"textDocument":{"uri":"file:///end.txt","text":"'"$text"'"}}}'
+    message '{"jsonrpc":"2.0","id":2,"method":"shutdown"}'
+    message '{"jsonrpc":"2.0","method":"exit"}'
+} | "$EDSACC" --lsp > lsp.out && grep -q '"diagnostics":\[\]' lsp.out
+check "E end F inside for and else in --lsp" $?
+
+# a program big enough to be parsed in chunks, with the same labels in every block,
+# it is too big for the store, so the objects are compared
+awk 'BEGIN {
+    print "T LAST_INSTRUCTION F\nE start F\n$N = 5\n~use_special_vars\nstart:"
+    for (k = 0; k < 20000; k++) {
+        print "x" k ": A 5 F"
+        if (k % 50 == 0)
+            print "    for $i" k "=0, 3 do\n        E end" k " F\n    end" k ":\n        A N F\n    end"
+        if (k % 70 == 0)
+            print "    if N < 0 then\n        A (N + 1) F\n    else\n        E end F\n    end"
+    }
+    print "end: ZF"
+}' > big.txt
+"$EDSACC" --jobs=1 --object --input=big.txt --output=big1.eo 2> big1.err &&
+    "$EDSACC" --jobs=8 --object --input=big.txt --output=big8.eo 2> big8.err &&
+    cmp -s big1.eo big8.eo && cmp -s big1.err big8.err
+check "--jobs=8 gives the object of --jobs=1" $?
+
+# expressions with spaces in an array block go through an object file
+cat > expr.txt <<'EOF'
+T LAST_INSTRUCTION F
+E start F
+$a = 4
+$b = (a + 2)
+$arr = { a + 1, 2 }
+~use_special_vars
+start:
+    T LAST_INSTRUCTION F
+    A b F
+    ZF
+EOF
+"$EDSACC" --input=expr.txt > expr.tape && "$EDSACC" --object --input=expr.txt --output=expr.eo &&
+    "$EDSACC" --link expr.eo > expr.link.tape && cmp -s expr.tape expr.link.tape
+check "{ a + 1 } through --object and --link" $?
+
+# checks of a[i] in one object find the size of the array in another one
+cat > main.txt <<'EOF'
+T LAST_INSTRUCTION F
+E start F
+$N = 3
+~use_special_vars
+start:
+    T LAST_INSTRUCTION F
+    for $j=0, N do
+        A arr[j] F
+    end
+    for $k=0, 3 do
+        A arr[k] F
+    end
+    ZF
+EOF
+echo '$arr = { 1, 2, 3 }' > lib.txt
+cat main.txt lib.txt > whole.txt
+"$EDSACC" --bounds-check --input=whole.txt > whole.tape && "$EDSACC" --bounds-check --object --input=main.txt --output=main.eo &&
+    "$EDSACC" --bounds-check --object --input=lib.txt --output=lib.eo &&
+    "$EDSACC" --bounds-check --link main.eo lib.eo > link.tape 2> link.err &&
+    cmp -s whole.tape link.tape && [ ! -s link.err ]
+check "bounds checks across two objects" $?
+
+# tapes of --bounds-check are cached
+"$EDSACC" --bounds-check --cache=cache --input=whole.txt > cached.tape && [ -n "$(ls cache)" ] &&
+    "$EDSACC" --bounds-check --cache=cache --input=whole.txt > cached.tape && cmp -s whole.tape cached.tape
+check "--bounds-check with --cache" $?
+
+# suffixes written for Initial Orders 2 stay as they are
+cat > suffix.txt <<'EOF'
+T LAST_INSTRUCTION F
+E start F
+x: P 1 F
+start:
+    A 5 L
+    A x F
+    ZS
+EOF
+"$EDSACC" --io=2 --input=suffix.txt > suffix.tape && grep -q 'A5L' suffix.tape && grep -q 'ZS' suffix.tape
+check "A 5 L and ZS under Initial Orders 2" $?
+
+# macros expand to the program written without them
+cat > macro.txt <<'EOF'
+~define N 5
+~define ADD(x, y) A x F A y F
+T LAST_INSTRUCTION F
+E start F
+start:
+    ADD(N, N) T N F
+    ZF
+EOF
+cat > nomacro.txt <<'EOF'
+T LAST_INSTRUCTION F
+E start F
+start:
+    A 5 F A 5 F T 5 F
+    ZF
+EOF
+"$EDSACC" --input=macro.txt > macro.tape && "$EDSACC" --input=nomacro.txt > nomacro.tape && cmp -s macro.tape nomacro.tape
+check "~define of names and functions" $?
+
+# positions of messages on lines with macros are counted in the source
+printf '~define LONGNAME 5\nT LAST_INSTRUCTION F\nE start F\nstart: A LONGNAME F 12345\n ZF\n' > column.txt
+"$EDSACC" --input=column.txt 2>&1 > /dev/null | grep -q '^warning:4:21:'
+check "columns of warnings after an expanded macro" $?
+
+# --lsp: hover and definition of a name below ~define lines, positions in UTF-16 after a non-ASCII comment
+cat > lsp.txt <<'EOF'
+~define A5 A 5 F
+~define TWO 2
+T LAST_INSTRUCTION F
+E start F
+x: P 5 F
+start: A5 A x F /* ф */ 12345
+ ZF
+EOF
+text=$(json_text lsp.txt)
+{
+    message '{"jsonrpc":"2.0","id":1,"method":"initialize","params":{}}'
+    message '{"jsonrpc":"2.0","method":"textDocument/didOpen","params":{"textDocument":{"uri":"file:///lsp.txt","text":"'"$text"'"}}}'
+    message '{"jsonrpc":"2.0","id":2,"method":"textDocument/hover","params":{"textDocument":{"uri":"file:///lsp.txt"},"position":{"line":5,"character":13}}}'
+    message '{"jsonrpc":"2.0","id":3,"method":"textDocument/definition","params":{"textDocument":{"uri":"file:///lsp.txt"},"position":{"line":5,"character":13}}}'
+    message '{"jsonrpc":"2.0","id":4,"method":"shutdown"}'
+    message '{"jsonrpc":"2.0","method":"exit"}'
+} | "$EDSACC" --lsp | tr -d ' ' > lsp.out
+grep -q '"start":{"line":5,"character":24}' lsp.out
+check "--lsp diagnostic after a macro and a non-ASCII character" $?
+grep -q '"value":"x=' lsp.out
+check "--lsp hover" $?
+grep -q '"range":{"start":{"line":4,"character":0},"end":{"line":4,"character":1}}' lsp.out
+check "--lsp definition below ~define lines" $?
+
+# addresses of orders as constant expressions and expressions of names
+cat > addr.txt <<'EOF'
+T LAST_INSTRUCTION F
+E start F
+x: P 5 F
+start:
+    A (2+3)*2 F
+    A x+1 F
+    T LAST_INSTRUCTION-1 F
+    ZF
+EOF
+# x is at 46, LAST_INSTRUCTION is 51
+"$EDSACC" --input=addr.txt > addr.tape && grep -q 'A10FA47FT50F' addr.tape
+check "constant and name expressions in addresses" $?
+
+# addresses out of the store
+printf 'T LAST_INSTRUCTION F\nE start F\nstart: A -1 F\n ZF\n' > negative.txt
+! "$EDSACC" --input=negative.txt > /dev/null 2> negative.err && grep -q '^compilation error:3:8: address -1' negative.err
+check "negative address is an error" $?
+printf 'T LAST_INSTRUCTION F\nE start F\nx: P 5 F\nstart: A x+2000 F\n ZF\n' > large.txt
+! "$EDSACC" --input=large.txt > /dev/null 2> large.err && grep -q '^link time error: link result address 2046' large.err
+check "address above the store is an error" $?
+
+# fractions: rounding, the range, and long words split like long integers
+value() {
+    printf 'T LAST_INSTRUCTION F\nE start F\n$x = %s\nstart: ZF\n' "$1" > value.txt
+    "$EDSACC" --input=value.txt 2>&1
+}
+[ "$(value 0.5)" = T48FE47FI0FZF ] && [ "$(value -0.5)" = T48FE47F\&0FZF ] && [ "$(value -1.0)" = T48FE47F.0FZF ]
+check "short fractions" $?
+[ "$(value 0.99999999)" = T48FE47F*2047DZF ]
+check "a fraction that rounds up to 1 is the largest one below it" $?
+value 1.0 | grep -q 'out of the range' && value -1.0000001 | grep -q 'out of the range'
+check "fractions out of the range" $?
+[ "$(value 0.5l)" = T49FE48FP0FI0FZF ] && [ "$(value -0.125l)" = T49FE48FP0FC0FZF ] &&
+    [ "$(value -1l)" = T49FE48FV2047DV2047DZF ]
+check "long fractions and integers share the split" $?
+printf 'T LAST_INSTRUCTION F\nE start F\n$a = { 0.25, -0.5, 3 }\nstart: ZF\n' > frac.txt
+"$EDSACC" --input=frac.txt | grep -q 'R0F&0FP1DZF'
+check "fractions in an array block" $?
+
+# a cached tape is the compiled one, a damaged entry is a miss, a file in place of the directory is no cache
+"$EDSACC" --input=addr.txt > plain.tape && "$EDSACC" --cache=cache2 --input=addr.txt > miss.tape &&
+    "$EDSACC" --cache=cache2 --input=addr.txt > hit.tape && cmp -s plain.tape miss.tape && cmp -s plain.tape hit.tape &&
+    [ "$(ls cache2 | wc -l)" = 1 ]
+check "--cache loads the compiled tape" $?
+for entry in cache2/*; do printf 'garbage' > "$entry"; done
+"$EDSACC" --cache=cache2 --input=addr.txt > damaged.tape && cmp -s plain.tape damaged.tape &&
+    "$EDSACC" --cache=cache2 --input=addr.txt > hit.tape && cmp -s plain.tape hit.tape
+check "--cache with a damaged entry" $?
+touch notadir
+"$EDSACC" --cache=notadir/cache --input=addr.txt > nodir.tape 2> nodir.err && cmp -s plain.tape nodir.tape &&
+    grep -q '^warning: .*compiling without the cache' nodir.err
+check "--cache without a usable directory" $?
+
+# memory images are the same on stdout, in a file and from the cache
+"$EDSACC" --format=image --input=addr.txt > stdout.img && "$EDSACC" --format=image --input=addr.txt --output=file.img &&
+    "$EDSACC" --format=image --cache=cache3 --input=addr.txt > /dev/null &&
+    "$EDSACC" --format=image --cache=cache3 --input=addr.txt > cached.img &&
+    [ "$(head -c 4 stdout.img)" = EDSI ] && cmp -s stdout.img file.img && cmp -s stdout.img cached.img
+check "--format=image to stdout, a file and the cache" $?
+
+# tables are computed as the numbers written in { }
+cat > table.txt <<'EOF'
+T LAST_INSTRUCTION F
+E start F
+$t = table(i*2, 0, 3)
+$s = table(i, 0, 10, 3)
+$p = [8]{ 1, table(1 << i, 1, 4)l }
+start: ZF
+EOF
+cat > notable.txt <<'EOF'
+T LAST_INSTRUCTION F
+E start F
+$t = { 0, 2, 4 }
+$s = { 0, 3, 6, 9 }
+$p = [8]{ 1, 2l, 4l, 8l }
+start: ZF
+EOF
+"$EDSACC" --input=table.txt > table.tape && "$EDSACC" --input=notable.txt > notable.tape && cmp -s table.tape notable.tape
+check "table() with a step and a suffix" $?
+
+# if with else and while, a, b, n and one are at 46-49, edsacc#tmp that keeps acc is at 50
+cat > if.txt <<'EOF'
+T LAST_INSTRUCTION F
+E start F
+a: P 1 F
+b: P 2 F
+n: P 3 F
+one: P 0 D
+~use_special_vars
+start:
+    T 0 F
+    if a < b then
+        A a F
+    else
+        A b F
+    end
+    T 0 F
+    while n >= 0 do
+        A n F
+        S one F
+        T n F
+    end
+    ZF
+EOF
+"$EDSACC" --input=if.txt > if.tape &&
+    grep -q 'TFA46FS47FE64FT80FA46FE66FG66FT80FA47FTFE74FG74FT80FA50FA48FS49FT48FT50FA48FE69FT80FA50FZF$' if.tape
+check "if, else and while" $?
+
+# sub and call: the link is A n F and G to the sub, which adds U 2 F and stores the return jump in its last word
+cat > sub.txt <<'EOF'
+T LAST_INSTRUCTION F
+E start F
+x: P 1 F
+one: P 0 D
+~use_special_vars
+sub inc_x
+    A x F
+    A one F
+    T x F
+endsub
+start:
+    T 0 F
+    call inc_x
+    call inc_x
+    ZF
+EOF
+cat > inline.txt <<'EOF'
+T LAST_INSTRUCTION F
+E start F
+x: P 1 F
+one: P 0 D
+~use_special_vars
+start:
+    T 0 F
+    A x F A one F T x F
+    T LAST_INSTRUCTION F
+    A x F A one F T x F
+    ZF
+EOF
+"$EDSACC" --input=sub.txt > sub.tape && grep -q 'E63FG63FA62FT61FA46FA47FT46FEFU2FTFA64FG56FT70FA67FG56FZF$' sub.tape
+check "sub and call" $?
+"$EDSACC" -O --input=sub.txt > inlined.tape && "$EDSACC" --input=inline.txt > inline.tape && cmp -s inlined.tape inline.tape
+check "-O inlines a small sub and removes it" $?
+
+# --io=1,2 parses the program once, the Initial Orders 1 tape is the one of the program written with S and L
+sed 's/ F$/ S/; s/ D$/ L/; s/ZF$/ZS/' sub.txt > sub1.txt
+"$EDSACC" --io=1,2 --input=sub.txt --output=prog.txt && "$EDSACC" --io=1 --input=sub1.txt > prog1.tape &&
+    cmp -s prog.io1.txt prog1.tape && cmp -s prog.io2.txt sub.tape &&
+    "$EDSACC" --io=1,2 --input=sub.txt > both.tape && { cat prog.io1.txt; echo; cat prog.io2.txt; echo; } | cmp -s - both.tape
+check "--io=1,2 to files and to stdout" $?
+
+# --bounds-check: checks that always pass are removed, a number index is checked at compilation
+cat > checks.txt <<'EOF'
+T LAST_INSTRUCTION F
+E start F
+$N = 3
+$arr = { 1, 2, 3 }
+x: P 1 F
+~use_special_vars
+start:
+    T LAST_INSTRUCTION F
+    for $j=0, N do
+        A arr[j] F
+    end
+    for $k=0, 3 do
+        A arr[k] F
+    end
+    A arr[2] F
+    A x[1] F
+    ZF
+EOF
+"$EDSACC" --bounds-check -d --input=checks.txt 2> checks.err > /dev/null &&
+    grep -qx 'bounds checks: 1 kept, 2 eliminated, 1 not checked (indexed names that are not arrays)' checks.err
+check "bounds checks removed at compilation" $?
+sed 's/arr\[2\]/arr[3]/' checks.txt > outside.txt
+"$EDSACC" --bounds-check --input=outside.txt > /dev/null 2> outside.err
+[ $? = 2 ] && grep -q "index 3 is out of bounds of array 'arr' of 3 elements" outside.err
+check "a number index out of the array is an error" $?
+
+exit $failed